@@ -1,25 +1,251 @@
 #include "Importers/MagicaVox.h"
 #include "VoxelAssets/VoxelDataAssetData.inl"
 
-#define OGT_VOX_IMPLEMENTATION
-#include "ogt_vox.h"
-
-#include "Misc/FileHelper.h"
-#include "Misc/ScopeExit.h"
 #include "Misc/MessageDialog.h"
+#include "Misc/ScopedSlowTask.h"
 #include "Modules/ModuleManager.h"
+#include "Templates/IntegerSequence.h"
+#include "Algo/StableSort.h"
+#include "Async/Async.h"
+#include "Containers/Ticker.h"
+#include "Hash/CityHash.h"
+#include "Importers/MagicaVoxTopology.h"
+
+static TSharedPtr<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe> ImportPool = nullptr;
+static TAutoConsoleVariable<int32> CVarImportThreads(TEXT("voxel.ImportThreads"), 0, TEXT("import pool threads. 0 = one per physical core but one"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarImportPinThreads(TEXT("voxel.ImportPinThreads"), 0, TEXT("pin each import thread to the logical cores of one physical core, neighbouring threads on cores sharing a last level cache, where the platform reports them"), ECVF_Default);
+static TAutoConsoleVariable<float> CVarImportPoolIdleTime(TEXT("voxel.ImportPoolIdleTime"), 30.f, TEXT("seconds without imports before the import pool is released. 0 = keep it"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarImportMergeOrder(TEXT("voxel.ImportMergeOrder"), 0, TEXT("which instance wins where instances overlap. 0 = last in file, 1 = last layer, then last in file"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarImportCache(TEXT("voxel.ImportCache"), 1, TEXT("reuse the merged scene of an unchanged .vox file from Saved/MagicaVoxCache"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarImportIncremental(TEXT("voxel.ImportIncremental"), 1, TEXT("only rewrite the bricks that changed since the cached import when the asset already has the scene's size"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarImportSlabBudget(TEXT("voxel.ImportSlabBudget"), 4096, TEXT("MB of merged voxels above which a scene is merged and written in Z slabs of about that size. 0 = always whole"), ECVF_Default);
+
+void* FMagicaVoxelArena::Alloc(int64 Size, int64 Alignment)
+{
+	FScopeLock Lock(&Section);
+	uint8* Result = Align(Cursor, Alignment);
+	if (Cursor == nullptr || Result + Size > End)
+	{
+		// big allocations get a block of their own and the current block keeps going
+		if (Size > BlockSize / 4)
+		{
+			void* Block = FMemory::Malloc(Size, Alignment);
+			Blocks.Add(Block);
+			AllocatedSize += Size;
+			return Block;
+		}
+		uint8* Block = static_cast<uint8*>(FMemory::Malloc(BlockSize, Alignment));
+		Blocks.Add(Block);
+		AllocatedSize += BlockSize;
+		Cursor = Block;
+		End = Block + BlockSize;
+		Result = Align(Cursor, Alignment);
+	}
+	Cursor = Result + Size;
+	return Result;
+}
+
+void FMagicaVoxelArena::Reset()
+{
+	FScopeLock Lock(&Section);
+	for (void* Block : Blocks)
+	{
+		FMemory::Free(Block);
+	}
+	Blocks.Empty();
+	Cursor = nullptr;
+	End = nullptr;
+	AllocatedSize = 0;
+}
+
+int64 FMagicaVoxelArena::GetAllocatedSize() const
+{
+	FScopeLock Lock(&Section);
+	return AllocatedSize;
+}
+
+// every work is preceded by the arena it came from, null for heap works
+static constexpr SIZE_T WorkHeaderSize = 16;
+
+void* IMagicaVoxelQueuedWork::operator new(size_t Size)
+{
+	uint8* Memory = static_cast<uint8*>(FMemory::Malloc(Size + WorkHeaderSize, WorkHeaderSize));
+	*reinterpret_cast<FMagicaVoxelArena**>(Memory) = nullptr;
+	return Memory + WorkHeaderSize;
+}
+
+void* IMagicaVoxelQueuedWork::operator new(size_t Size, FMagicaVoxelArena& Arena)
+{
+	uint8* Memory = static_cast<uint8*>(Arena.Alloc(Size + WorkHeaderSize, WorkHeaderSize));
+	*reinterpret_cast<FMagicaVoxelArena**>(Memory) = &Arena;
+	return Memory + WorkHeaderSize;
+}
+
+void IMagicaVoxelQueuedWork::operator delete(void* Ptr)
+{
+	if (Ptr)
+	{
+		uint8* Memory = static_cast<uint8*>(Ptr) - WorkHeaderSize;
+		// arena works go away with their arena
+		if (*reinterpret_cast<FMagicaVoxelArena**>(Memory) == nullptr)
+		{
+			FMemory::Free(Memory);
+		}
+	}
+}
+
+void IMagicaVoxelQueuedWork::operator delete(void* Ptr, FMagicaVoxelArena& Arena)
+{
+	// only called when a constructor throws, the arena keeps the memory
+}
+
+bool IMagicaVoxelQueuedWork::IsCancelled() const
+{
+	return Group.IsValid() && Group->IsCancelled();
+}
+
+FMagicaVoxelTaskGroup::FMagicaVoxelTaskGroup(const FMagicaVoxelCancelTokenPtr& InCancelToken)
+	: CancelToken(InCancelToken)
+	, DoneEvent(FPlatformProcess::GetSynchEventFromPool(true))
+{
+	NumPending.Increment();
+}
+
+FMagicaVoxelTaskGroup::~FMagicaVoxelTaskGroup()
+{
+	FPlatformProcess::ReturnSynchEventToPool(DoneEvent);
+}
+
+FMagicaVoxelTaskGroupRef FMagicaVoxelTaskGroup::Create(const FMagicaVoxelCancelTokenPtr& InCancelToken)
+{
+	return MakeShareable(new FMagicaVoxelTaskGroup(InCancelToken));
+}
+
+void FMagicaVoxelTaskGroup::Close()
+{
+	CompletePending();
+}
+
+bool FMagicaVoxelTaskGroup::Wait(uint32 WaitTimeMs)
+{
+	return bDone || DoneEvent->Wait(WaitTimeMs);
+}
+
+void FMagicaVoxelTaskGroup::OnComplete(TFunction<void()>&& Callback)
+{
+	{
+		FScopeLock Lock(&Section);
+		if (!bDone)
+		{
+			Callbacks.Add(MoveTemp(Callback));
+			return;
+		}
+	}
+	Callback();
+}
+
+float FMagicaVoxelTaskGroup::GetProgress() const
+{
+	const int32 Num = NumWorks.GetValue();
+	return Num > 0 ? float(NumWorksDone.GetValue()) / Num : (bDone ? 1.f : 0.f);
+}
+
+void FMagicaVoxelTaskGroup::AddPending(int32 Num)
+{
+	check(!bDone);
+	NumWorks.Add(Num);
+	NumPending.Add(Num);
+}
+
+void FMagicaVoxelTaskGroup::CompleteWork()
+{
+	NumWorksDone.Increment();
+	CompletePending();
+}
+
+void FMagicaVoxelTaskGroup::CompletePending()
+{
+	if (NumPending.Decrement() == 0)
+	{
+		TArray<TFunction<void()>> LocalCallbacks;
+		{
+			FScopeLock Lock(&Section);
+			bDone = true;
+			LocalCallbacks = MoveTemp(Callbacks);
+		}
+		DoneEvent->Trigger();
+		for (auto& Callback : LocalCallbacks)
+		{
+			Callback();
+		}
+	}
+}
+
+void FMagicaVoxelQueuedThreadPool::FWorkQueue::Push(const FQueuedWorkInfo& InWorkInfo)
+{
+	FScopeLock Lock(Section);
+	Works.HeapPush(InWorkInfo);
+}
+
+void FMagicaVoxelQueuedThreadPool::FWorkQueue::Push(TArrayView<IMagicaVoxelQueuedWork* const> InWorks, int32 InFirstQueue, int32 InNumQueues)
+{
+	FScopeLock Lock(Section);
+	for (int32 Index = 0; Index < InWorks.Num(); Index++)
+	{
+		Works.HeapPush(FQueuedWorkInfo(InWorks[Index], Index, InFirstQueue, InNumQueues));
+	}
+}
+
+IMagicaVoxelQueuedWork* FMagicaVoxelQueuedThreadPool::FWorkQueue::Pop()
+{
+	FScopeLock Lock(Section);
+	if (Works.Num() == 0)
+	{
+		return nullptr;
+	}
+	FQueuedWorkInfo WorkInfo;
+	Works.HeapPop(WorkInfo, false);
+	return WorkInfo.Work;
+}
+
+IMagicaVoxelQueuedWork* FMagicaVoxelQueuedThreadPool::FWorkQueue::Steal(TFunctionRef<bool(const FQueuedWorkInfo&)> CanSteal)
+{
+	FScopeLock Lock(Section);
+	// usually one of the leaves, the second half of the heap, but a leaf the thief may not run hides the lowest work it may
+	int32 Lowest = INDEX_NONE;
+	for (int32 Index = 0; Index < Works.Num(); Index++)
+	{
+		if ((Lowest == INDEX_NONE || Works[Index].GetPriority() < Works[Lowest].GetPriority()) && CanSteal(Works[Index]))
+		{
+			Lowest = Index;
+		}
+	}
+	if (Lowest == INDEX_NONE)
+	{
+		return nullptr;
+	}
+	IMagicaVoxelQueuedWork* Work = Works[Lowest].Work;
+	Works.HeapRemoveAt(Lowest, false);
+	return Work;
+}
 
-static uint8 ImportThreads = 12;
-static TSharedPtr<FMagicaVoxelQueuedThreadPool> ImportPool = nullptr;
-static TAutoConsoleVariable<int32> CVarLogImport(TEXT("voxel.LogImport"),0,TEXT("enable import logs"),ECVF_Default);
-static TAutoConsoleVariable<int32> CVarDebugSurfaceLevel(TEXT("voxel.DebugSurfaceLevel"), 70,TEXT("log index with z = surface level"),ECVF_Default);
+void FMagicaVoxelQueuedThreadPool::FWorkQueue::AbandonAll()
+{
+	FScopeLock Lock(Section);
+	for (const FQueuedWorkInfo& WorkInfo : Works)
+	{
+		AbandonWork(WorkInfo.Work);
+	}
+	Works.Reset();
+}
 
-FMagicaVoxelQueuedThreadPool::FQueuedThread::FQueuedThread(FMagicaVoxelQueuedThreadPool* Pool, const FString& ThreadName, uint32 StackSize, EThreadPriority ThreadPriority)
+FMagicaVoxelQueuedThreadPool::FQueuedThread::FQueuedThread(FMagicaVoxelQueuedThreadPool* Pool, const FString& ThreadName, int32 ThreadIndex, uint32 StackSize, EThreadPriority ThreadPriority, uint64 AffinityMask)
 	: ThreadName(ThreadName)
+	, ThreadIndex(ThreadIndex)
 	, ThreadPool(Pool)
 	, DoWorkEvent(FPlatformProcess::GetSynchEventFromPool()) // Create event BEFORE thread
 	, TimeToDie(false) // BEFORE creating thread
-	, Thread(FRunnableThread::Create(this, *ThreadName, StackSize, ThreadPriority, FPlatformAffinity::GetPoolThreadMask()))
+	, Thread(FRunnableThread::Create(this, *ThreadName, StackSize, ThreadPriority, AffinityMask))
 {
 	check(Thread.IsValid());
 }
@@ -42,14 +268,11 @@ uint32 FMagicaVoxelQueuedThreadPool::FQueuedThread::Run()
 {
 	while (!TimeToDie)
 	{
-		// We need to wait for shorter amount of time
-		bool bContinueWaiting = true;
-		while (bContinueWaiting)
 		{
 			VOXEL_ASYNC_VERBOSE_SCOPE_COUNTER("FVoxelQueuedThread::Run.WaitForWork");
 
-			// Wait for some work to do
-			bContinueWaiting = !DoWorkEvent->Wait(10);
+			// Wait for some work to do, producers always trigger idle threads after queueing
+			DoWorkEvent->Wait();
 		}
 
 		if (!TimeToDie)
@@ -58,15 +281,9 @@ uint32 FMagicaVoxelQueuedThreadPool::FQueuedThread::Run()
 
 			while (LocalQueuedWork)
 			{
-				//const FName Name = LocalQueuedWork->Name;
-
-				//const double StartTime = FPlatformTime::Seconds();
-
-				LocalQueuedWork->DoThreadedWork();
+				ExecuteWork(LocalQueuedWork);
 				// IMPORTANT: LocalQueuedWork should be considered as deleted after this line
 
-				//const double EndTime = FPlatformTime::Seconds();
-
 				LocalQueuedWork = ThreadPool->ReturnToPoolOrGetNextJob(this);
 			}
 		}
@@ -80,7 +297,7 @@ FMagicaVoxelQueuedThreadPool::FMagicaVoxelQueuedThreadPool(uint32 NumThreads, ui
 	for (uint32 ThreadIndex = 0; ThreadIndex < NumThreads; ThreadIndex++)
 	{
 		const FString Name = FString::Printf(TEXT("MagicaVoxelThread %d"), ThreadIndex);
-		AllThreads.Add(MakeUnique<FQueuedThread>(this, Name, StackSize, ThreadPriority));
+		AllThreads.Add(MakeUnique<FQueuedThread>(this, Name, ThreadIndex, StackSize, ThreadPriority, GetThreadAffinityMask(ThreadIndex)));
 	}
 	//
 	QueuedThreads.Reserve(NumThreads);
@@ -90,6 +307,24 @@ FMagicaVoxelQueuedThreadPool::FMagicaVoxelQueuedThreadPool(uint32 NumThreads, ui
 	}
 }
 
+uint64 FMagicaVoxelQueuedThreadPool::GetThreadAffinityMask(int32 ThreadIndex)
+{
+	const uint64 PoolMask = FPlatformAffinity::GetPoolThreadMask();
+	if (CVarImportPinThreads.GetValueOnAnyThread() == 0)
+	{
+		return PoolMask;
+	}
+	static const TArray<uint64> CoreMasks = MagicaVox::GetPhysicalCoreMasks();
+	if (CoreMasks.Num() == 0)
+	{
+		return PoolMask;
+	}
+	// thread i gets physical core i. cores come grouped by last level cache, so the threads that steal from each other first share it
+	const uint64 CoreMask = CoreMasks[ThreadIndex % CoreMasks.Num()];
+	// don't fight the engine's own reservations
+	return (CoreMask & PoolMask) != 0 ? CoreMask & PoolMask : PoolMask;
+}
+
 FMagicaVoxelQueuedThreadPool::~FMagicaVoxelQueuedThreadPool()
 {
 	AbandonAllTasks();
@@ -101,52 +336,161 @@ bool FMagicaVoxelQueuedThreadPool::IsWorking()
 	return AllThreads.Num() != QueuedThreads.Num();
 }
 
-void FMagicaVoxelQueuedThreadPool::AddQueuedWork(IMagicaVoxelQueuedWork* InQueuedWork)
+void FMagicaVoxelQueuedThreadPool::AddQueuedWork(IMagicaVoxelQueuedWork* InQueuedWork, const FMagicaVoxelTaskGroupRef& InGroup)
 {
-	check(IsInGameThread());
 	check(InQueuedWork);
 
+	InGroup->AddPending(1);
+	InQueuedWork->Group = InGroup;
+	InQueuedWork->QueuedTime = MagicaVox::FMagicaVoxTrace::IsEnabled() ? FPlatformTime::Seconds() : 0.0;
 	if (TimeToDie)
 	{
-		InQueuedWork->Abandon();
+		AbandonWork(InQueuedWork);
 		return;
 	}
 
-	FQueuedWorkInfo WorkInfo(InQueuedWork);
-	//
-	Section.Lock();
-	QueuedWorks.push(WorkInfo);
-	for (auto* QueuedThread : QueuedThreads)
+	const int32 NumThreads = AllThreads.Num();
+	AllThreads[uint32(NextQueue.Increment()) % NumThreads]->Queue.Push(FQueuedWorkInfo(InQueuedWork, 0, 0, NumThreads));
+	NumPushes.Increment();
+	WakeUpIdleThreads(0, NumThreads);
+}
+
+void FMagicaVoxelQueuedThreadPool::AddQueuedWorks(const TArray<IMagicaVoxelQueuedWork*>& InQueuedWorks, const FMagicaVoxelTaskGroupRef& InGroup, int32 InMaxThreads)
+{
+	InGroup->AddPending(InQueuedWorks.Num());
+	const double QueuedTime = MagicaVox::FMagicaVoxTrace::IsEnabled() ? FPlatformTime::Seconds() : 0.0;
+	for (auto* InQueuedWork : InQueuedWorks)
 	{
-		QueuedThread->DoWorkEvent->Trigger();
+		InQueuedWork->Group = InGroup;
+		InQueuedWork->QueuedTime = QueuedTime;
+	}
+	if (TimeToDie)
+	{
+		for (auto* InQueuedWork : InQueuedWorks)
+		{
+			AbandonWork(InQueuedWork);
+		}
+		return;
+	}
+	if (InQueuedWorks.Num() == 0)
+	{
+		return;
+	}
+	// contiguous ranges per thread, works are usually created in spatial order. the works stay as small as they were created,
+	// only NumQueues threads get a range and only they may steal them.
+	// batches covering every thread start at the first one, so consecutive stages give the same region to the same core.
+	// capped batches come from small scenes, those rotate so concurrent imports spread over the pool
+	const int32 NumThreads = AllThreads.Num();
+	const int32 NumQueues = InMaxThreads > 0 ? FMath::Min(InMaxThreads, NumThreads) : NumThreads;
+	const int32 ChunkSize = FMath::DivideAndRoundUp(InQueuedWorks.Num(), NumQueues);
+	const int32 FirstQueue = NumQueues == NumThreads && InQueuedWorks.Num() >= NumThreads ? 0 : int32(uint32(NextQueue.Add(FMath::Min(InQueuedWorks.Num(), NumQueues))) % NumThreads);
+	for (int32 Chunk = 0; Chunk * ChunkSize < InQueuedWorks.Num(); Chunk++)
+	{
+		const int32 Start = Chunk * ChunkSize;
+		const TArrayView<IMagicaVoxelQueuedWork* const> Works(InQueuedWorks.GetData() + Start, FMath::Min(ChunkSize, InQueuedWorks.Num() - Start));
+		AllThreads[(FirstQueue + Chunk) % NumThreads]->Queue.Push(Works, FirstQueue, NumQueues);
 	}
-	QueuedThreads.Reset();
-	Section.Unlock();
+	NumPushes.Increment();
+	WakeUpIdleThreads(FirstQueue, NumQueues);
 }
 
-void FMagicaVoxelQueuedThreadPool::AddQueuedWorks(const TArray<IMagicaVoxelQueuedWork*>& InQueuedWorks)
+FMagicaVoxelTaskGroupRef FMagicaVoxelQueuedThreadPool::AddQueuedWorks(const TArray<IMagicaVoxelQueuedWork*>& InQueuedWorks, const FMagicaVoxelCancelTokenPtr& InCancelToken)
 {
-	check(IsInGameThread());
+	const FMagicaVoxelTaskGroupRef Group = FMagicaVoxelTaskGroup::Create(InCancelToken);
+	AddQueuedWorks(InQueuedWorks, Group);
+	Group->Close();
+	return Group;
+}
 
-	if (TimeToDie)
+bool FMagicaVoxelQueuedThreadPool::Wait(const FMagicaVoxelTaskGroupRef& InGroup, uint32 WaitTimeMs)
+{
+	// a single work can outlast any timeout, bounded waits like a progress dialog's poll only sleep
+	if (WaitTimeMs != MAX_uint32)
 	{
-		for (auto* InQueuedWork : InQueuedWorks)
+		return InGroup->Wait(WaitTimeMs);
+	}
+	// woken by every push and once the group is done. the completion callback may run after we returned, it shares the event
+	struct FHelperEvent
+	{
+		FEvent* const Event = FPlatformProcess::GetSynchEventFromPool();
+		~FHelperEvent() { FPlatformProcess::ReturnSynchEventToPool(Event); }
+	};
+	const TSharedRef<FHelperEvent, ESPMode::ThreadSafe> HelperEvent = MakeShared<FHelperEvent, ESPMode::ThreadSafe>();
+	{
+		FScopeLock Lock(Section);
+		WaitingHelpers.Add(HelperEvent->Event);
+	}
+	InGroup->OnComplete([HelperEvent]() { HelperEvent->Event->Trigger(); });
+	while (!InGroup->IsDone())
+	{
+		// the group's own import only, including stages queued after this wait started
+		if (IMagicaVoxelQueuedWork* Work = PopOrSteal(INDEX_NONE, &InGroup.Get()))
 		{
-			InQueuedWork->Abandon();
+			ExecuteWork(Work);
+			continue;
 		}
+		HelperEvent->Event->Wait();
+	}
+	{
+		FScopeLock Lock(Section);
+		WaitingHelpers.RemoveSwap(HelperEvent->Event);
+	}
+	return true;
+}
+
+void FMagicaVoxelQueuedThreadPool::ExecuteWork(IMagicaVoxelQueuedWork* InQueuedWork)
+{
+	if (InQueuedWork->IsCancelled())
+	{
+		AbandonWork(InQueuedWork);
 		return;
 	}
-	//
-	FScopeLock Lock(Section);
-	for (auto* InQueuedWork : InQueuedWorks)
+	// keep the group alive past the work, the work still reads it for cancellation
+	const FMagicaVoxelTaskGroupPtr Group = InQueuedWork->Group;
+	const bool bTrace = MagicaVox::FMagicaVoxTrace::IsEnabled();
+	const FName Name = InQueuedWork->Name;
+	const double QueuedTime = InQueuedWork->QueuedTime;
+	const double StartTime = bTrace ? FPlatformTime::Seconds() : 0.0;
+	InQueuedWork->DoThreadedWork();
+	// IMPORTANT: InQueuedWork should be considered as deleted after this line
+	if (bTrace)
+	{
+		MagicaVox::FMagicaVoxTrace::AddWork(Name, QueuedTime, StartTime, FPlatformTime::Seconds());
+	}
+	if (Group.IsValid())
+	{
+		Group->CompleteWork();
+	}
+}
+
+void FMagicaVoxelQueuedThreadPool::AbandonWork(IMagicaVoxelQueuedWork* InQueuedWork)
+{
+	const FMagicaVoxelTaskGroupPtr Group = MoveTemp(InQueuedWork->Group);
+	InQueuedWork->Abandon();
+	if (Group.IsValid())
 	{
-		QueuedWorks.emplace(InQueuedWork);
+		Group->bAbandoned = true;
+		Group->CompleteWork();
 	}
-	for (auto* QueuedThread : QueuedThreads)
+}
+
+void FMagicaVoxelQueuedThreadPool::WakeUpIdleThreads(int32 FirstQueue, int32 NumQueues)
+{
+	const int32 NumThreads = AllThreads.Num();
+	FScopeLock Lock(Section);
+	QueuedThreads.RemoveAllSwap([&](FQueuedThread* QueuedThread)
 	{
+		if ((QueuedThread->ThreadIndex - FirstQueue + NumThreads) % NumThreads >= NumQueues)
+		{
+			return false;
+		}
 		QueuedThread->DoWorkEvent->Trigger();
+		return true;
+	});
+	for (FEvent* Helper : WaitingHelpers)
+	{
+		Helper->Trigger();
 	}
-	QueuedThreads.Reset();
 }
 
 void FMagicaVoxelQueuedThreadPool::AbandonAllTasks()
@@ -160,10 +504,9 @@ void FMagicaVoxelQueuedThreadPool::AbandonAllTasks()
 		FScopeLock Lock(Section);
 		TimeToDie = true;
 		// Clean up all queued objects
-		while (!QueuedWorks.empty())
+		for (auto& Thread : AllThreads)
 		{
-			QueuedWorks.top().Work->Abandon();
-			QueuedWorks.pop();
+			Thread->Queue.AbandonAll();
 		}
 	}
 	// Wait for all threads to finish up
@@ -180,23 +523,49 @@ void FMagicaVoxelQueuedThreadPool::AbandonAllTasks()
 	}
 }
 
+IMagicaVoxelQueuedWork* FMagicaVoxelQueuedThreadPool::PopOrSteal(int32 ThreadIndex, const FMagicaVoxelTaskGroup* InHelpedGroup)
+{
+	// INDEX_NONE is a helping thread outside of the pool, it only steals
+	IMagicaVoxelQueuedWork* Work = ThreadIndex != INDEX_NONE ? AllThreads[ThreadIndex]->Queue.Pop() : nullptr;
+	const int32 NumThreads = AllThreads.Num();
+	const auto CanSteal = [&](const FQueuedWorkInfo& WorkInfo)
+	{
+		if (ThreadIndex != INDEX_NONE)
+		{
+			return WorkInfo.CanRunOn(ThreadIndex, NumThreads);
+		}
+		// queued works always have their group. an import's groups share its cancel token
+		const FMagicaVoxelTaskGroup& Group = *WorkInfo.Work->Group;
+		return InHelpedGroup->GetCancelToken().IsValid() ? Group.GetCancelToken() == InHelpedGroup->GetCancelToken() : &Group == InHelpedGroup;
+	};
+	// steal from the closest threads first, they got the neighbouring ranges
+	const int32 FirstVictim = ThreadIndex != INDEX_NONE ? ThreadIndex + 1 : 0;
+	for (int32 Offset = 0; !Work && Offset < NumThreads - (ThreadIndex != INDEX_NONE); Offset++)
+	{
+		Work = AllThreads[(FirstVictim + Offset) % NumThreads]->Queue.Steal(CanSteal);
+	}
+	return Work;
+}
+
 IMagicaVoxelQueuedWork* FMagicaVoxelQueuedThreadPool::ReturnToPoolOrGetNextJob(FQueuedThread* InQueuedThread)
 {
 	check(InQueuedThread);
 
-	FScopeLock Lock(Section);
-
-	if (!QueuedWorks.empty())
-	{
-		auto* Work = QueuedWorks.top().Work;
-		QueuedWorks.pop();
-		check(Work);
-		return Work;
-	}
-	else
+	while (true)
 	{
-		QueuedThreads.Add(InQueuedThread);
-		return nullptr;
+		const int32 Pushes = NumPushes.GetValue();
+		if (IMagicaVoxelQueuedWork* Work = PopOrSteal(InQueuedThread->ThreadIndex))
+		{
+			return Work;
+		}
+
+		FScopeLock Lock(Section);
+		// a producer that pushed after our scan either bumped the counter already or will wake us up
+		if (NumPushes.GetValue() == Pushes || TimeToDie)
+		{
+			QueuedThreads.Add(InQueuedThread);
+			return nullptr;
+		}
 	}
 }
 
@@ -217,177 +586,1369 @@ TSharedRef<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe> FMagicaVoxelQueued
 	return Pool;
 }
 
-bool MagicaVox::ImportToAsset(const FString& Filename, FVoxelDataAssetData& Asset, const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
+MagicaVox::FMagicaVoxSceneData::~FMagicaVoxSceneData()
+{
+	Reset();
+}
+
+void MagicaVox::FMagicaVoxSceneData::Init(const FVoxelIntBox& InBounds)
+{
+	Reset();
+	Bounds = InBounds;
+	Size = InBounds.Size();
+	NumBricks = FIntVector(FMath::DivideAndRoundUp(Size.X, BrickSize), FMath::DivideAndRoundUp(Size.Y, BrickSize), FMath::DivideAndRoundUp(Size.Z, BrickSize));
+	Bricks.SetNumZeroed(NumBricks.X * NumBricks.Y * NumBricks.Z);
+}
+
+void MagicaVox::FMagicaVoxSceneData::InitExternal(const FVoxelIntBox& InBounds, TArrayView<const int32> InBrickIndices, const uint8* InBrickData)
+{
+	Init(InBounds);
+	bExternal = true;
+	for (int32 Index = 0; Index < InBrickIndices.Num(); Index++)
+	{
+		// never written through, Set checks bExternal
+		Bricks[InBrickIndices[Index]] = const_cast<uint8*>(InBrickData + int64(Index) * BrickBytes);
+	}
+}
+
+int64 MagicaVox::FMagicaVoxSceneData::CountBrickIndices(const FVoxelIntBox& InBounds)
+{
+	const FIntVector BoundsSize = InBounds.Size();
+	if (BoundsSize.GetMin() < 0)
+	{
+		return 0;
+	}
+	return int64(FMath::DivideAndRoundUp(BoundsSize.X, BrickSize)) * FMath::DivideAndRoundUp(BoundsSize.Y, BrickSize) * FMath::DivideAndRoundUp(BoundsSize.Z, BrickSize);
+}
+
+void MagicaVox::FMagicaVoxSceneData::Reset()
+{
+	Bricks.Empty();
+	BrickArena.Reset();
+	bExternal = false;
+	Bounds = FVoxelIntBox();
+	Size = FIntVector::ZeroValue;
+	NumBricks = FIntVector::ZeroValue;
+}
+
+void MagicaVox::FMagicaVoxSceneData::ReleaseBricks()
+{
+	check(!bExternal);
+	FMemory::Memzero(Bricks.GetData(), Bricks.NumBytes());
+	BrickArena.Reset();
+}
+
+int32 MagicaVox::FMagicaVoxSceneData::GetNumAllocatedBricks() const
+{
+	int32 Num = 0;
+	for (const uint8* Brick : Bricks)
+	{
+		Num += Brick ? 1 : 0;
+	}
+	return Num;
+}
+
+void MagicaVox::FMagicaVoxSceneData::Set(int32 X, int32 Y, int32 Z, uint8 Value)
+{
+	checkSlow(IsValidPosition(X, Y, Z));
+	check(!bExternal);
+	const int32 BrickIndex = GetBrickIndex(X, Y, Z);
+	uint8* Brick = Bricks[BrickIndex];
+	if (Brick == nullptr)
+	{
+		if (Value == 0)
+		{
+			return;
+		}
+		Brick = AddBrick(BrickIndex);
+	}
+	Brick[GetIndexInBrick(X, Y, Z)] = Value;
+	uint32& RowMask = GetRowMasks(Brick)[(Y & BrickMask) + ((Z & BrickMask) << BrickShift)];
+	const uint32 Bit = 1u << (X & BrickMask);
+	if (Value != 0)
+	{
+		RowMask |= Bit;
+	}
+	else
+	{
+		RowMask &= ~Bit;
+	}
+}
+
+uint8* MagicaVox::FMagicaVoxSceneData::AddBrick(int32 BrickIndex)
+{
+	uint8* Brick = static_cast<uint8*>(BrickArena.Alloc(BrickBytes, PLATFORM_CACHE_LINE_SIZE));
+	FMemory::Memzero(Brick, BrickBytes);
+	Bricks[BrickIndex] = Brick;
+	return Brick;
+}
+
+// not sized from the file: a small file can instance a few models hundreds of times, the work is in the instance voxels and the scene volume.
+// each import caps the threads it uses once its scene is indexed, see GetSceneThreads
+static int32 GetImportThreads()
+{
+	const int32 NumThreads = CVarImportThreads.GetValueOnAnyThread();
+	if (NumThreads > 0)
+	{
+		return NumThreads;
+	}
+	// one per physical core, hyperthreads don't help the value pass and the game thread keeps one core
+	return FMath::Max(FPlatformMisc::NumberOfCores() - 1, 1);
+}
+
+// threads worth waking for a scene, about one per 256K voxels of work. an explicit voxel.ImportThreads is taken as is
+static int32 GetSceneThreads(int64 InInstanceVoxels, const FIntVector& InSceneSize)
+{
+	const int32 NumThreads = GetImportThreads();
+	if (CVarImportThreads.GetValueOnAnyThread() > 0)
+	{
+		return NumThreads;
+	}
+	// merging costs about a write per instance voxel, the value pass writes every cell but mostly as runs of air
+	const int64 Work = InInstanceVoxels + int64(InSceneSize.X) * InSceneSize.Y * InSceneSize.Z / 8;
+	return int32(FMath::Clamp<int64>(FMath::DivideAndRoundUp<int64>(Work, 256 * 1024), 1, NumThreads));
+}
+
+// releases the pool once nothing used it for voxel.ImportPoolIdleTime, the next import creates one sized for itself.
+// tasks hold a reference to their pool, so it's only ever destroyed here on the game thread
+static bool TickImportPool(float DeltaTime)
+{
+	static double LastUsedTime = 0.0;
+	const float IdleTime = CVarImportPoolIdleTime.GetValueOnGameThread();
+	if (!ImportPool.IsValid())
+	{
+		return true;
+	}
+	if (IdleTime <= 0.f || ImportPool.GetSharedReferenceCount() > 1 || ImportPool->IsWorking())
+	{
+		LastUsedTime = FPlatformTime::Seconds();
+	}
+	else if (FPlatformTime::Seconds() - LastUsedTime > IdleTime)
+	{
+		ImportPool.Reset();
+	}
+	return true;
+}
+
+// InNumThreads only grows the pool, and only while nothing else holds it
+static TSharedRef<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe> GetImportPool(int32 InNumThreads)
+{
+	if (!ImportPool.IsValid() || (ImportPool->GetNumThreads() < InNumThreads && ImportPool.GetSharedReferenceCount() == 1 && !ImportPool->IsWorking()))
+	{
+		check(IsInGameThread());
+		static bool bTickerAdded = false;
+		if (!bTickerAdded)
+		{
+			bTickerAdded = true;
+			FTSTicker::GetCoreTicker().AddTicker(TEXT("MagicaVoxImportPool"), 1.f, &TickImportPool);
+		}
+		ImportPool.Reset();
+		ImportPool = FMagicaVoxelQueuedThreadPool::Create(InNumThreads, 1024 * 1024, EThreadPriority::TPri_Normal);
+		check(ImportPool.IsValid());
+	}
+	return ImportPool.ToSharedRef();
+}
+
+bool MagicaVox::ReleaseImportPool()
+{
+	check(IsInGameThread());
+	if (ImportPool.IsValid() && (ImportPool.GetSharedReferenceCount() > 1 || ImportPool->IsWorking()))
+	{
+		return false;
+	}
+	ImportPool.Reset();
+	return true;
+}
+
+namespace MagicaVoxUnify
+{
+	static bool GetAxisPermutation(const FMatrix44f& InMatrix, int32& OutPermutation);
+}
+
+// 0 when the merged scene fits voxel.ImportSlabBudget, otherwise layers per slab.
+// slabs are merge tile aligned so they never share a brick, and the value pass never reads another layer so they need no halo
+static int32 GetSlabLayers(const FIntVector& InSceneSize)
+{
+	const int64 Budget = int64(CVarImportSlabBudget.GetValueOnAnyThread()) * 1024 * 1024;
+	const int64 LayerBytes = int64(InSceneSize.X) * InSceneSize.Y;
+	if (Budget <= 0 || LayerBytes * InSceneSize.Z <= Budget)
+	{
+		return 0;
+	}
+	constexpr int32 TileSize = MagicaVox::FMagicaVoxMergeWork::TileSize;
+	return int32(FMath::Clamp<int64>(Budget / LayerBytes / TileSize, 1, FMath::DivideAndRoundUp(InSceneSize.Z, TileSize))) * TileSize;
+}
+
+namespace MagicaVoxMerge
+{
+	static FString GetInstanceError(const MagicaVox::FMagicaVoxInstance& Inst)
+	{
+		return FString::Printf(TEXT("failed to import model index[%d] at transofrom[%s]"), Inst.ModelIndex, *Inst.Transform.ToString());
+	}
+
+	// cheap first pass, bounds only depend on model size and transform
+	// the index matrix doesn't depend on where the instance is, so model and rotation decide the payload
+	static bool GatherInstances(const MagicaVox::FMagicaVoxScene& InScene, FVoxelIntBox& OutBounds, MagicaVox::FMagicaVoxUnifiedData& OutData, FString& OutError)
+	{
+		const auto& Models = InScene.GetModels();
+		const auto& Instances = InScene.GetInstances();
+		OutData.Reset();
+		OutData.Instances.Reserve(Instances.Num());
+		TMap<TPair<int32, int32>, int32> SharedPayloads;
+		for (int32 Index = 0; Index < Instances.Num(); Index++)
+		{
+			const auto& Inst = Instances[Index];
+			FVoxelIntBox Bounds;
+			FMatrix44f IndexMatrix;
+			if (!Models.IsValidIndex(Inst.ModelIndex) || !MagicaVox::GetUnifiedTransform(Models[Inst.ModelIndex].Size, Inst.Transform, Bounds, IndexMatrix))
+			{
+				OutError = GetInstanceError(Inst);
+				return false;
+			}
+			OutBounds = OutBounds + Bounds;
+			// generic transforms may round differently per position, they always get their own payload
+			int32 Permutation;
+			const bool bShared = MagicaVoxUnify::GetAxisPermutation(IndexMatrix, Permutation);
+			const int32* SharedPayload = bShared ? SharedPayloads.Find(TPair<int32, int32>(Inst.ModelIndex, Permutation)) : nullptr;
+			int32 Payload = SharedPayload ? *SharedPayload : INDEX_NONE;
+			if (Payload == INDEX_NONE)
+			{
+				Payload = OutData.Sources.Add({ Inst.ModelIndex, Index });
+				if (bShared)
+				{
+					SharedPayloads.Add(TPair<int32, int32>(Inst.ModelIndex, Permutation), Payload);
+				}
+			}
+			OutData.Instances.Add({ Bounds.Min, Payload });
+		}
+		OutData.Payloads.SetNum(OutData.Sources.Num());
+		OutData.Failed.SetNumZeroed(OutData.Sources.Num());
+		return true;
+	}
+
+	static IMagicaVoxelQueuedWork* CreateUnifyWork(FMagicaVoxelArena& InArena, const MagicaVox::FMagicaVoxScene& InScene, int32 InPayload, MagicaVox::FMagicaVoxUnifiedData& OutData)
+	{
+		const auto& Source = OutData.Sources[InPayload];
+		return new (InArena) MagicaVox::FMagicaVoxUnifyWork(InScene.GetModels()[Source.ModelIndex], InScene.GetInstances()[Source.Instance].Transform, InArena, OutData.Payloads[InPayload], OutData.Failed[InPayload]);
+	}
+
+	static bool CheckUnified(const MagicaVox::FMagicaVoxScene& InScene, const MagicaVox::FMagicaVoxUnifiedData& InData, FString& OutError)
+	{
+		const int32 FailedPayload = InData.Failed.Find(true);
+		if (FailedPayload != INDEX_NONE)
+		{
+			OutError = GetInstanceError(InScene.GetInstances()[InData.Sources[FailedPayload].Instance]);
+			return false;
+		}
+		return true;
+	}
+
+	// later instances in merge order overwrite earlier ones where they overlap
+	static TArray<int32> GetMergeOrder(const MagicaVox::FMagicaVoxScene& InScene)
+	{
+		const auto& Instances = InScene.GetInstances();
+		TArray<int32> MergeOrder;
+		MergeOrder.Reserve(Instances.Num());
+		for (int32 Index = 0; Index < Instances.Num(); Index++)
+		{
+			MergeOrder.Add(Index);
+		}
+		if (CVarImportMergeOrder.GetValueOnAnyThread() == 1)
+		{
+			Algo::StableSortBy(MergeOrder, [&](int32 Index) { return Instances[Index].LayerIndex; });
+		}
+		return MergeOrder;
+	}
+}
+
+bool MagicaVox::ImportToAsset(const FString& Filename, FVoxelDataAssetData& Asset, const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
+{
+	const auto Task = FMagicaVoxImportTask::Launch(Filename, Asset, nullptr, InSetting, nullptr);
+	{
+		static const FText PhaseNames[] =
+		{
+			FText::FromString(TEXT("Reading MagicaVoxel file")),
+			FText::FromString(TEXT("Decoding MagicaVoxel scene")),
+			FText::FromString(TEXT("Unifying MagicaVoxel instances")),
+			FText::FromString(TEXT("Merging MagicaVoxel instances")),
+			FText::FromString(TEXT("Computing voxel values")),
+		};
+		const float NumPhases = float(EMagicaVoxImportPhase::Done);
+		FScopedSlowTask SlowTask(NumPhases, PhaseNames[0]);
+		SlowTask.MakeDialog(true);
+		float Reported = 0.f;
+		while (!Task->Wait(50))
+		{
+			if (SlowTask.ShouldCancel())
+			{
+				Task->Cancel();
+			}
+			const EMagicaVoxImportPhase Phase = Task->GetPhase();
+			const float Progress = Phase == EMagicaVoxImportPhase::Done ? NumPhases : int32(Phase) + Task->GetPhaseProgress();
+			if (Progress > Reported)
+			{
+				SlowTask.EnterProgressFrame(Progress - Reported, PhaseNames[FMath::Min(int32(Phase), int32(EMagicaVoxImportPhase::Done) - 1)]);
+				Reported = Progress;
+			}
+		}
+	}
+	if (!Task->IsSuccess() && !Task->IsCancelled())
+	{
+		FMessageDialog::Open(EAppMsgType::Ok, FText::FromString(Task->GetError()));
+	}
+	return Task->IsSuccess();
+}
+
+TSharedRef<MagicaVox::FMagicaVoxImportTask, ESPMode::ThreadSafe> MagicaVox::ImportToAssetAsync(const FString& Filename, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, FMagicaVoxImportCallback&& OnComplete)
+{
+	const TSharedRef<FVoxelDataAssetData> Asset = MakeShared<FVoxelDataAssetData>();
+	return FMagicaVoxImportTask::Launch(Filename, *Asset, Asset, InSetting, MoveTemp(OnComplete));
+}
+
+TSharedRef<MagicaVox::FMagicaVoxImportTask, ESPMode::ThreadSafe> MagicaVox::FMagicaVoxImportTask::Launch(const FString& InFilename, FVoxelDataAssetData& InAsset, const TSharedPtr<FVoxelDataAssetData>& InOwnedAsset, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, FMagicaVoxImportCallback&& InOnComplete)
+{
+	const TSharedRef<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe> Pool = GetImportPool(GetImportThreads());
+	const TSharedRef<FMagicaVoxImportTask, ESPMode::ThreadSafe> Task = MakeShareable(new FMagicaVoxImportTask(Pool, InFilename, InAsset, InOwnedAsset, InSetting, MoveTemp(InOnComplete)));
+	Task->RunStage(EMagicaVoxImportPhase::Read, { new FMagicaVoxLambdaWork("FMagicaVoxReadWork", [Task]() { Task->Read(); }) }, &FMagicaVoxImportTask::Decode);
+	return Task;
+}
+
+MagicaVox::FMagicaVoxImportTask::FMagicaVoxImportTask(const TSharedRef<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe>& InPool, const FString& InFilename, FVoxelDataAssetData& InAsset, const TSharedPtr<FVoxelDataAssetData>& InOwnedAsset, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, FMagicaVoxImportCallback&& InOnComplete)
+	: Pool(InPool)
+	, Filename(InFilename)
+	, Asset(InAsset)
+	, OwnedAsset(InOwnedAsset)
+	, Setting(InSetting)
+	, OnComplete(MoveTemp(InOnComplete))
+	, CancelToken(MakeShared<FMagicaVoxelCancelToken, ESPMode::ThreadSafe>())
+	, DoneGroup(FMagicaVoxelTaskGroup::Create(CancelToken))
+	, TraceId(FMagicaVoxTrace::NewImportId())
+	, MaxThreads(InPool->GetNumThreads())
+	, PhaseStartTime(FPlatformTime::Seconds())
+{
+}
+
+float MagicaVox::FMagicaVoxImportTask::GetPhaseProgress() const
+{
+	FScopeLock Lock(&Section);
+	return StageGroup.IsValid() ? StageGroup->GetProgress() : 0.f;
+}
+
+double MagicaVox::FMagicaVoxImportTask::GetPhaseSeconds(EMagicaVoxImportPhase InPhase) const
+{
+	FScopeLock Lock(&Section);
+	if (InPhase == EMagicaVoxImportPhase::Done)
+	{
+		return 0.0;
+	}
+	return PhaseSeconds[int32(InPhase)] + (Phase == InPhase ? FPlatformTime::Seconds() - PhaseStartTime : 0.0);
+}
+
+void MagicaVox::FMagicaVoxImportTask::SetPhase(EMagicaVoxImportPhase InPhase)
+{
+	static const FName PhaseNames[] = { TEXT("Read"), TEXT("Decode"), TEXT("Unify"), TEXT("Merge"), TEXT("Value") };
+	static_assert(UE_ARRAY_COUNT(PhaseNames) == int32(EMagicaVoxImportPhase::Done), "one name per phase");
+	const double Now = FPlatformTime::Seconds();
+	if (Phase != EMagicaVoxImportPhase::Done)
+	{
+		PhaseSeconds[int32(Phase.Load())] += Now - PhaseStartTime;
+		if (FMagicaVoxTrace::IsEnabled())
+		{
+			FMagicaVoxTrace::AddPhase(PhaseNames[int32(Phase.Load())], TraceId, PhaseStartTime, Now);
+		}
+	}
+	PhaseStartTime = Now;
+	Phase = InPhase;
+}
+
+FString MagicaVox::FMagicaVoxImportTask::GetError() const
+{
+	FScopeLock Lock(&Section);
+	return Error;
+}
+
+bool MagicaVox::FMagicaVoxImportTask::Wait(uint32 WaitTimeMs)
+{
+	return Pool->Wait(DoneGroup, WaitTimeMs);
+}
+
+void MagicaVox::FMagicaVoxImportTask::RunStage(EMagicaVoxImportPhase InPhase, TArray<IMagicaVoxelQueuedWork*>&& InWorks, void (FMagicaVoxImportTask::*InNext)())
+{
+	const FMagicaVoxelTaskGroupRef Group = FMagicaVoxelTaskGroup::Create(CancelToken);
+	{
+		FScopeLock Lock(&Section);
+		SetPhase(InPhase);
+		StageGroup = Group;
+	}
+	Pool->AddQueuedWorks(InWorks, Group, MaxThreads);
+	if (InNext)
+	{
+		// the group runs its own callbacks, it outlives them
+		Group->OnComplete([Self = AsShared(), InNext, StageGroupPtr = &Group.Get()]()
+		{
+			if (Self->IsCancelled())
+			{
+				Self->Finish(TEXT("import cancelled"));
+			}
+			else if (StageGroupPtr->IsAbandoned())
+			{
+				// the stage's output is incomplete, nothing after it may read it
+				Self->Finish(TEXT("import abandoned, the import pool was shut down"));
+			}
+			else
+			{
+				(Self.Get().*InNext)();
+			}
+		});
+	}
+	Group->Close();
+}
+
+void MagicaVox::FMagicaVoxImportTask::Read()
+{
+	if (!Scene.Open(Filename, ReadError) || CVarImportCache.GetValueOnAnyThread() == 0)
+	{
+		return;
+	}
+	CacheKey.FileHash = FMagicaVoxCacheKey::HashFile(Scene.GetFileData(), Scene.GetFileSize());
+	CacheKey.FileSize = Scene.GetFileSize();
+	CacheKey.MergeOrder = CVarImportMergeOrder.GetValueOnAnyThread();
+	CacheKey.SettingsHash = FMagicaVoxHexOccupancy::HashSetting(Setting);
+	ValueSettingsHash = FMagicaVoxImportWork::HashSetting(Setting);
+	const FString CachePath = FMagicaVoxSceneCache::GetCachePath(Filename);
+	bHasPreviousStamp = PreviousStamp.Load(FMagicaVoxAssetStamp::GetStampPath(CachePath));
+	if (Cache.Load(CachePath, CacheKey))
+	{
+		BrickHashes = TArray<uint64>(Cache.GetBrickHashes());
+		PreviousBrickHashes = BrickHashes;
+		PreviousSettingsHash = Cache.GetSettingsHash();
+		return;
+	}
+	// stale cache, its hashes still tell which bricks the edit touched
+	FMagicaVoxSceneCache::LoadBrickHashes(CachePath, PreviousBounds, PreviousSettingsHash, PreviousBrickHashes);
+}
+
+void MagicaVox::FMagicaVoxImportTask::Decode()
+{
+	if (!ReadError.IsEmpty())
+	{
+		Finish(ReadError);
+		return;
+	}
+	if (Cache.IsLoaded())
+	{
+		// same file and merge order as the cached import, the merged scene is already there
+		Cache.GetSceneData(SceneData);
+		PreviousBounds = SceneData.GetBounds();
+		MaxThreads = GetSceneThreads(0, SceneData.GetSize());
+		Value();
+		return;
+	}
+	// one pass over the chunk headers, voxel lists stay untouched in the mapped file
+	FString IndexError;
+	FVoxelIntBox SceneBounds;
+	if (!Scene.Index(IndexError) || !MagicaVoxMerge::GatherInstances(Scene, SceneBounds, UnifiedData, IndexError))
+	{
+		Finish(IndexError);
+		return;
+	}
+	SceneData.Init(SceneBounds);
+	int64 InstanceVoxels = 0;
+	for (const FMagicaVoxInstance& Inst : Scene.GetInstances())
+	{
+		InstanceVoxels += Scene.GetModels()[Inst.ModelIndex].NumVoxels;
+	}
+	MaxThreads = GetSceneThreads(InstanceVoxels, SceneData.GetSize());
+	SlabLayers = GetSlabLayers(SceneData.GetSize());
+	if (IsStreaming())
+	{
+		// the whole merged scene never exists, so there is nothing to cache or to compare against
+		CacheKey = FMagicaVoxCacheKey();
+		PreviousBrickHashes.Empty();
+		const FIntVector& Size = SceneData.GetSize();
+		Asset.SetSize(FIntVector(Size.Y, Size.X, Size.Z), true, true);			// MagicaVoxe and UE use different coordination
+		Occupancy.Init(SceneData, Setting);
+		SlabMinZ = 0;
+		StartSlab();
+		return;
+	}
+	ModelPayloads.Reset();
+	ModelPayloads.SetNum(Scene.GetModels().Num());
+	for (int32 Payload = 0; Payload < UnifiedData.Sources.Num(); Payload++)
+	{
+		ModelPayloads[UnifiedData.Sources[Payload].ModelIndex].Add(Payload);
+	}
+	RunStage(EMagicaVoxImportPhase::Decode, CreateDecodeWorks(), &FMagicaVoxImportTask::Merge);
+}
+
+TArray<IMagicaVoxelQueuedWork*> MagicaVox::FMagicaVoxImportTask::CreateDecodeWorks()
+{
+	// decode and unify share one stage, each decoded model queues the unify works of its payloads
+	TArray<IMagicaVoxelQueuedWork*> Works;
+	for (int32 ModelIndex = 0; ModelIndex < ModelPayloads.Num(); ModelIndex++)
+	{
+		if (ModelPayloads[ModelIndex].Num() > 0)
+		{
+			// these keep the task, and with it the arena, alive so they stay on the heap
+			Works.Add(new FMagicaVoxLambdaWork("FMagicaVoxDecodeWork", [Self = AsShared(), ModelIndex]() { Self->DecodeModel(ModelIndex); }));
+		}
+	}
+	NumModelsToDecode.Set(Works.Num());
+	return Works;
+}
+
+void MagicaVox::FMagicaVoxImportTask::DecodeModel(int32 ModelIndex)
+{
+	Scene.DecodeModel(ModelIndex);
+	TArray<IMagicaVoxelQueuedWork*> Works;
+	for (const int32 Payload : ModelPayloads[ModelIndex])
+	{
+		IMagicaVoxelQueuedWork* Work = MagicaVoxMerge::CreateUnifyWork(Arena, Scene, Payload, UnifiedData);
+		// ahead of the remaining decodes so the model is unified while it is still in cache
+		Work->Priority = 1;
+		Works.Add(Work);
+	}
+	FMagicaVoxelTaskGroupPtr Group;
+	{
+		FScopeLock Lock(&Section);
+		Group = StageGroup;
+		if (NumModelsToDecode.Decrement() == 0)
+		{
+			SetPhase(EMagicaVoxImportPhase::Unify);
+		}
+	}
+	// the stage can't complete while this work is running, adding to it is safe
+	Pool->AddQueuedWorks(Works, Group.ToSharedRef(), MaxThreads);
+}
+
+void MagicaVox::FMagicaVoxImportTask::StartSlab()
+{
+	if (SlabMinZ >= SceneData.GetSize().Z)
+	{
+		Succeed();
+		return;
+	}
+	// the previous slab is written and its works are gone, layers never read each other so none of its voxels are needed anymore
+	Arena.Reset();
+	SceneData.ReleaseBricks();
+	// only the instances overlapping the slab are unified and merged, payloads spanning several slabs are unified again for each
+	const int32 SceneMinZ = SceneData.GetBounds().Min.Z;
+	const int32 SlabMaxZ = GetSlabMaxZ();
+	TBitArray<> SlabPayloads(false, UnifiedData.Payloads.Num());
+	for (int32 Instance = 0; Instance < UnifiedData.Instances.Num(); Instance++)
+	{
+		const FVoxelIntBox Bounds = UnifiedData.GetInstanceBounds(Instance);
+		if (Bounds.Min.Z - SceneMinZ < SlabMaxZ && Bounds.Max.Z - SceneMinZ > SlabMinZ)
+		{
+			SlabPayloads[UnifiedData.Instances[Instance].Payload] = true;
+		}
+	}
+	ModelPayloads.Reset();
+	ModelPayloads.SetNum(Scene.GetModels().Num());
+	for (TConstSetBitIterator<> It(SlabPayloads); It; ++It)
+	{
+		ModelPayloads[UnifiedData.Sources[It.GetIndex()].ModelIndex].Add(It.GetIndex());
+	}
+	RunStage(EMagicaVoxImportPhase::Decode, CreateDecodeWorks(), &FMagicaVoxImportTask::Merge);
+}
+
+void MagicaVox::FMagicaVoxImportTask::NextSlab()
+{
+	SlabMinZ += SlabLayers;
+	StartSlab();
+}
+
+void MagicaVox::FMagicaVoxImportTask::Merge()
+{
+	FString UnifyError;
+	if (!MagicaVoxMerge::CheckUnified(Scene, UnifiedData, UnifyError))
+	{
+		Finish(UnifyError);
+		return;
+	}
+	RunStage(EMagicaVoxImportPhase::Merge, FMagicaVoxMergeWork::Create(Arena, SceneData, UnifiedData, MagicaVoxMerge::GetMergeOrder(Scene), SlabMinZ, GetSlabMaxZ()), &FMagicaVoxImportTask::Value);
+}
+
+void MagicaVox::FMagicaVoxImportTask::Value()
+{
+	// merged voxels are all we need from here, the unify and merge works are gone so their arena goes in one shot
+	if (IsStreaming())
+	{
+		// the next slabs unify their instances again
+		for (FMagicaVoxSpanData& Payload : UnifiedData.Payloads)
+		{
+			Payload = FMagicaVoxSpanData();
+		}
+	}
+	else
+	{
+		UnifiedData.Reset();
+		ModelPayloads.Empty();
+		Scene.Reset();
+		Occupancy.Init(SceneData, Setting);
+	}
+	Arena.Reset();
+	TArray<IMagicaVoxelQueuedWork*> Works;
+	if (Cache.GetOccupancyBits().Num() == 0 || !Occupancy.SetBits(Cache.GetOccupancyBits()))
+	{
+		Works = Occupancy.CreateWorks(Arena, SlabMinZ, GetSlabMaxZ());
+		// a cache built with other hexagon settings gets these bits once the values are written
+		bResaveCache = Cache.IsLoaded() && !IsStreaming();
+	}
+	if (!Cache.IsLoaded() && CacheKey.FileSize > 0)
+	{
+		// hashed next to the occupancy pass, both only read the merged scene
+		static constexpr int32 BricksPerWork = 256;
+		BrickHashes.SetNumUninitialized(SceneData.GetNumBrickIndices());
+		for (int32 Start = 0; Start < BrickHashes.Num(); Start += BricksPerWork)
+		{
+			Works.Add(new (Arena) FMagicaVoxLambdaWork("FMagicaVoxBrickHashWork", [this, Start]()
+			{
+				for (int32 BrickIndex = Start; BrickIndex < FMath::Min(Start + BricksPerWork, BrickHashes.Num()); BrickIndex++)
+				{
+					BrickHashes[BrickIndex] = FMagicaVoxSceneCache::HashBrick(SceneData.GetBrick(BrickIndex));
+				}
+			}));
+		}
+	}
+	const FIntVector& Size = SceneData.GetSize();
+	if (!IsStreaming() && bHasPreviousStamp && CVarImportIncremental.GetValueOnAnyThread() != 0 && Asset.GetSize() == FIntVector(Size.Y, Size.X, Size.Z))
+	{
+		// nothing writes the asset before the next stage
+		Works.Append(CreateAssetHashWorks());
+	}
+	if (Works.Num() == 0)
+	{
+		WriteValues();
+		return;
+	}
+	RunStage(EMagicaVoxImportPhase::Value, MoveTemp(Works), &FMagicaVoxImportTask::WriteValues);
+}
+
+void MagicaVox::FMagicaVoxImportTask::WriteValues()
+{
+	if (IsStreaming())
+	{
+		// slabs are brick aligned, their bricks are one contiguous range of indices
+		const FIntVector& NumBricks = SceneData.GetNumBricks();
+		const int32 BricksPerLayer = NumBricks.X * NumBricks.Y;
+		const int32 MinBrick = SlabMinZ / FMagicaVoxSceneData::BrickSize * BricksPerLayer;
+		const int32 MaxBrick = FMath::DivideAndRoundUp(GetSlabMaxZ(), FMagicaVoxSceneData::BrickSize) * BricksPerLayer;
+		TBitArray<> SlabBricks(false, SceneData.GetNumBrickIndices());
+		SlabBricks.SetRange(MinBrick, MaxBrick - MinBrick, true);
+		RunStage(EMagicaVoxImportPhase::Value, FMagicaVoxImportWork::Create(Arena, Asset, SceneData, Occupancy, Setting, &SlabBricks, TraceId), &FMagicaVoxImportTask::NextSlab);
+		return;
+	}
+	// chunk hashes are only there when the value stage hashed the asset as it was before this import
+	if (AssetChunkHashes.Num() > 0)
+	{
+		PreviousAssetHash = GetAssetHash();
+	}
+	const TOptional<TBitArray<>> ChangedBricks = GetChangedBricks();
+	const TOptional<TBitArray<>> DirtyBricks = ChangedBricks.IsSet() ? FMagicaVoxImportWork::GetDirtyBricks(SceneData, Setting, ChangedBricks.GetValue()) : TOptional<TBitArray<>>();
+	bAssetWritten = !DirtyBricks.IsSet() || DirtyBricks->Find(true) != INDEX_NONE;
+	TArray<IMagicaVoxelQueuedWork*> Works = FMagicaVoxImportWork::Create(Arena, Asset, SceneData, Occupancy, Setting, DirtyBricks.GetPtrOrNull(), TraceId);
+	if (CacheKey.FileSize > 0 && (!Cache.IsLoaded() || bResaveCache))
+	{
+		Works.Add(new FMagicaVoxLambdaWork("FMagicaVoxCacheWork", [Self = AsShared()]() { Self->SaveCache(); }));
+	}
+	RunStage(EMagicaVoxImportPhase::Value, MoveTemp(Works), CacheKey.FileSize > 0 ? &FMagicaVoxImportTask::StampAsset : &FMagicaVoxImportTask::Succeed);
+}
+
+TOptional<TBitArray<>> MagicaVox::FMagicaVoxImportTask::GetChangedBricks() const
+{
+	// the asset has to hold exactly what the import that wrote the previous brick hashes left in it. the cache is only keyed by the file,
+	// so another asset imported from it, or this one edited or imported with other settings since, falls back to a full write
+	const FIntVector& Size = SceneData.GetSize();
+	if (CVarImportIncremental.GetValueOnAnyThread() == 0
+		|| Asset.GetSize() != FIntVector(Size.Y, Size.X, Size.Z)
+		// the tile writer fills materials too, an asset created without them is sized again
+		|| Asset.GetRawMaterials().Num() != Asset.GetRawValues().Num()
+		|| !bHasPreviousStamp
+		|| !PreviousAssetHash.IsSet()
+		|| PreviousStamp.AssetHash != PreviousAssetHash.GetValue()
+		|| PreviousStamp.SettingsHash != ValueSettingsHash
+		|| PreviousStamp.SceneHash != FMagicaVoxAssetStamp::HashScene(PreviousBounds, PreviousBrickHashes)
+		|| PreviousBounds.Min != SceneData.GetBounds().Min
+		|| PreviousBounds.Max != SceneData.GetBounds().Max
+		|| PreviousSettingsHash != CacheKey.SettingsHash
+		|| PreviousBrickHashes.Num() != BrickHashes.Num()
+		|| BrickHashes.Num() != SceneData.GetNumBrickIndices())
+	{
+		return {};
+	}
+	TBitArray<> Changed(false, BrickHashes.Num());
+	for (int32 BrickIndex = 0; BrickIndex < BrickHashes.Num(); BrickIndex++)
+	{
+		Changed[BrickIndex] = BrickHashes[BrickIndex] != PreviousBrickHashes[BrickIndex];
+	}
+	return Changed;
+}
+
+void MagicaVox::FMagicaVoxImportTask::SaveCache()
+{
+	// the value works only read the scene and the occupancy
+	const FString CachePath = FMagicaVoxSceneCache::GetCachePath(Filename);
+	if (Cache.IsLoaded())
+	{
+		// the scene reads the mapped cache until Finish, the file is only replaced once it's unmapped
+		PendingCachePath = FMagicaVoxSceneCache::SaveTemp(CachePath, CacheKey, SceneData, Occupancy.GetBits(), BrickHashes);
+		if (PendingCachePath.IsEmpty())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("failed to write import cache %s"), *CachePath);
+		}
+	}
+	else if (!FMagicaVoxSceneCache::Save(CachePath, CacheKey, SceneData, Occupancy.GetBits(), BrickHashes))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("failed to write import cache %s"), *CachePath);
+	}
+}
+
+TArray<IMagicaVoxelQueuedWork*> MagicaVox::FMagicaVoxImportTask::CreateAssetHashWorks()
+{
+	static constexpr int64 ChunkSize = 64 << 20;
+	const TPair<const uint8*, int64> Arrays[] =
+	{
+		{ reinterpret_cast<const uint8*>(Asset.GetRawValues().GetData()), int64(Asset.GetRawValues().Num()) * sizeof(FVoxelValue) },
+		{ reinterpret_cast<const uint8*>(Asset.GetRawMaterials().GetData()), int64(Asset.GetRawMaterials().Num()) * sizeof(FVoxelMaterial) },
+	};
+	int32 NumChunks = 0;
+	for (const TPair<const uint8*, int64>& Array : Arrays)
+	{
+		NumChunks += int32(FMath::DivideAndRoundUp(Array.Value, ChunkSize));
+	}
+	AssetChunkHashes.SetNumZeroed(NumChunks);
+	TArray<IMagicaVoxelQueuedWork*> Works;
+	int32 Chunk = 0;
+	for (const TPair<const uint8*, int64>& Array : Arrays)
+	{
+		for (int64 Offset = 0; Offset < Array.Value; Offset += ChunkSize, Chunk++)
+		{
+			const uint8* Data = Array.Key + Offset;
+			const int64 Size = FMath::Min(ChunkSize, Array.Value - Offset);
+			Works.Add(new (Arena) FMagicaVoxLambdaWork("FMagicaVoxAssetHashWork", [this, Chunk, Data, Size]()
+			{
+				AssetChunkHashes[Chunk] = FMagicaVoxCacheKey::HashFile(Data, Size);
+			}));
+		}
+	}
+	return Works;
+}
+
+uint64 MagicaVox::FMagicaVoxImportTask::GetAssetHash() const
+{
+	const FIntVector Size = Asset.GetSize();
+	uint64 Hash = FMagicaVoxCacheKey::HashFile(reinterpret_cast<const uint8*>(&Size), sizeof(FIntVector));
+	return Hash ^ FMagicaVoxCacheKey::HashFile(reinterpret_cast<const uint8*>(AssetChunkHashes.GetData()), AssetChunkHashes.NumBytes());
+}
+
+void MagicaVox::FMagicaVoxImportTask::StampAsset()
+{
+	Arena.Reset();
+	// nothing was rewritten, the chunk hashes taken before writing still hold
+	TArray<IMagicaVoxelQueuedWork*> Works = bAssetWritten ? CreateAssetHashWorks() : TArray<IMagicaVoxelQueuedWork*>();
+	if (Works.Num() == 0)
+	{
+		SaveAssetStamp();
+		return;
+	}
+	RunStage(EMagicaVoxImportPhase::Value, MoveTemp(Works), &FMagicaVoxImportTask::SaveAssetStamp);
+}
+
+void MagicaVox::FMagicaVoxImportTask::SaveAssetStamp()
+{
+	FMagicaVoxAssetStamp Stamp;
+	Stamp.SceneHash = FMagicaVoxAssetStamp::HashScene(SceneData.GetBounds(), BrickHashes);
+	Stamp.SettingsHash = ValueSettingsHash;
+	Stamp.AssetHash = GetAssetHash();
+	const FString StampPath = FMagicaVoxAssetStamp::GetStampPath(FMagicaVoxSceneCache::GetCachePath(Filename));
+	if (!Stamp.Save(StampPath))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("failed to write import stamp %s"), *StampPath);
+	}
+	Succeed();
+}
+
+void MagicaVox::FMagicaVoxImportTask::Succeed()
+{
+	Finish(FString());
+}
+
+void MagicaVox::FMagicaVoxImportTask::Finish(const FString& InError)
+{
+	{
+		FScopeLock Lock(&Section);
+		SetPhase(EMagicaVoxImportPhase::Done);
+		StageGroup.Reset();
+		Error = InError;
+		bSuccess = InError.IsEmpty();
+	}
+#if MAGICAVOX_DEBUG_CAPTURE
+	// every value work is done
+	FMagicaVoxDebugCapture::Dump(TraceId, Filename);
+#endif
+	Scene.Reset();
+	SceneData.Reset();
+	Cache.Reset();
+	if (!PendingCachePath.IsEmpty())
+	{
+		const FString CachePath = FMagicaVoxSceneCache::GetCachePath(Filename);
+		if (!FMagicaVoxSceneCache::Replace(CachePath, PendingCachePath))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("failed to replace import cache %s"), *CachePath);
+		}
+		PendingCachePath.Reset();
+	}
+	BrickHashes.Empty();
+	PreviousBrickHashes.Empty();
+	AssetChunkHashes.Empty();
+	Occupancy.Reset();
+	UnifiedData.Reset();
+	ModelPayloads.Empty();
+	Arena.Reset();
+	if (OnComplete)
+	{
+		AsyncTask(ENamedThreads::GameThread, [Self = AsShared()]()
+		{
+			Self->OnComplete(Self->bSuccess, Self->OwnedAsset, Self->Error);
+			Self->OnComplete = nullptr;
+		});
+	}
+	DoneGroup->Close();
+}
+
+namespace MagicaVoxUnify
+{
+	// MagicaVoxel rotations are always one of the 48 signed axis permutations: 6 axis orders * 8 sign combinations.
+	// permutation index = AxisOrder * 8 + SignMask, destination axis j reads source axis SourceAxes[AxisOrder][j]
+	static constexpr int32 NumPermutations = 48;
+	static constexpr int32 SourceAxes[6][3] = { { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 }, { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 } };
+
+	static bool GetAxisPermutation(const FMatrix44f& InMatrix, int32& OutPermutation)
+	{
+		int32 Axes[3];
+		int32 SignMask = 0;
+		for (int32 DestAxis = 0; DestAxis < 3; DestAxis++)
+		{
+			Axes[DestAxis] = INDEX_NONE;
+			for (int32 SourceAxis = 0; SourceAxis < 3; SourceAxis++)
+			{
+				const float Value = InMatrix.M[SourceAxis][DestAxis];
+				if (Value == 0.f)
+				{
+					continue;
+				}
+				if (FMath::Abs(Value) != 1.f || Axes[DestAxis] != INDEX_NONE)
+				{
+					return false;
+				}
+				Axes[DestAxis] = SourceAxis;
+				SignMask |= Value < 0.f ? 1 << DestAxis : 0;
+			}
+			// translation has to land on the voxel grid for the integer path to match the float one
+			const float Translation = InMatrix.M[3][DestAxis];
+			if (Axes[DestAxis] == INDEX_NONE || FMath::Frac(Translation) != 0.f)
+			{
+				return false;
+			}
+		}
+		for (int32 AxisOrder = 0; AxisOrder < 6; AxisOrder++)
+		{
+			if (SourceAxes[AxisOrder][0] == Axes[0] && SourceAxes[AxisOrder][1] == Axes[1] && SourceAxes[AxisOrder][2] == Axes[2])
+			{
+				OutPermutation = AxisOrder * 8 + SignMask;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// per thread encode buffers. unify works reuse them and only copy the final payload into the import arena
+	struct FUnifyScratch
+	{
+		FIntVector Size = FIntVector::ZeroValue;
+		TArray<uint32> RowOffsets;
+		TArray<MagicaVox::FMagicaVoxSpan> Spans;
+		TArray<uint8> Colors;
+		// EncodeVoxelList buckets
+		TArray<int32> RowStarts;
+		TArray<int32> VoxelRows;
+		TArray<uint16> VoxelXs;
+		TArray<int32> RowVoxels;
+		TArray<int32> Cursors;
+
+		SIZE_T GetAllocatedSize() const
+		{
+			return RowOffsets.GetAllocatedSize() + Spans.GetAllocatedSize() + Colors.GetAllocatedSize() + RowStarts.GetAllocatedSize()
+				+ VoxelRows.GetAllocatedSize() + VoxelXs.GetAllocatedSize() + RowVoxels.GetAllocatedSize() + Cursors.GetAllocatedSize();
+		}
+	};
+	// above this a thread gives its buffers back after the model, one huge model shouldn't pin memory on every thread
+	static constexpr SIZE_T MaxUnifyScratchSize = 64 * 1024 * 1024;
+
+	static FUnifyScratch& GetUnifyScratch()
+	{
+		static thread_local FUnifyScratch Scratch;
+		return Scratch;
+	}
+
+	// appends runs of non-empty voxels of one destination row
+	static void BeginSpans(const FIntVector& InSize, FUnifyScratch& OutData)
+	{
+		OutData.Size = InSize;
+		OutData.RowOffsets.Reset(InSize.Y * InSize.Z + 1);
+		OutData.Spans.Reset();
+		OutData.Colors.Reset();
+	}
+
+	static void AddRowSpans(const uint8* Row, int32 SizeX, int32 Y, int32 Z, FUnifyScratch& OutData)
+	{
+		OutData.RowOffsets.Add(OutData.Spans.Num());
+		int32 X = 0;
+		while (X < SizeX)
+		{
+			if (Row[X] == 0)
+			{
+				X++;
+				continue;
+			}
+			const int32 Start = X;
+			while (X < SizeX && Row[X] != 0)
+			{
+				X++;
+			}
+			OutData.Spans.Add({ uint16(Start), uint16(Y), uint16(Z), uint16(X - Start), uint32(OutData.Colors.Num()) });
+			OutData.Colors.Append(Row + Start, X - Start);
+		}
+	}
+
+	// buckets the decoded voxel list by destination row, then encodes each row through a scratch row so later voxels win like they did in the dense grid
+	// GetDest maps a source voxel to the destination and returns false when it falls outside
+	template<typename FGetDest>
+	static void EncodeVoxelList(const MagicaVox::FMagicaVoxModel& InModel, const FIntVector& InDestSize, FGetDest&& GetDest, FUnifyScratch& OutData)
+	{
+		const int32 NumRows = InDestSize.Y * InDestSize.Z;
+		TArray<int32>& RowStarts = OutData.RowStarts;
+		RowStarts.Reset();
+		RowStarts.SetNumZeroed(NumRows + 1, false);
+		TArray<int32>& VoxelRows = OutData.VoxelRows;
+		TArray<uint16>& VoxelXs = OutData.VoxelXs;
+		VoxelRows.SetNumUninitialized(InModel.NumVoxels, false);
+		VoxelXs.SetNumUninitialized(InModel.NumVoxels, false);
+		for (int32 Index = 0; Index < InModel.NumVoxels; Index++)
+		{
+			const uint8* Voxel = InModel.Voxels + Index * 4;
+			FIntVector Dest;
+			if (!GetDest(Voxel[0], Voxel[1], Voxel[2], Dest))
+			{
+				VoxelRows[Index] = INDEX_NONE;
+				continue;
+			}
+			VoxelRows[Index] = Dest.Y + InDestSize.Y * Dest.Z;
+			VoxelXs[Index] = uint16(Dest.X);
+			RowStarts[VoxelRows[Index] + 1]++;
+		}
+		for (int32 Row = 0; Row < NumRows; Row++)
+		{
+			RowStarts[Row + 1] += RowStarts[Row];
+		}
+		// stable counting sort, voxels keep their file order inside a row
+		TArray<int32>& RowVoxels = OutData.RowVoxels;
+		RowVoxels.SetNumUninitialized(RowStarts[NumRows], false);
+		{
+			TArray<int32>& Cursors = OutData.Cursors;
+			Cursors.Reset();
+			Cursors.Append(RowStarts.GetData(), NumRows);
+			for (int32 Index = 0; Index < InModel.NumVoxels; Index++)
+			{
+				if (VoxelRows[Index] != INDEX_NONE)
+				{
+					RowVoxels[Cursors[VoxelRows[Index]]++] = Index;
+				}
+			}
+		}
+
+		BeginSpans(InDestSize, OutData);
+		OutData.Colors.Reserve(RowVoxels.Num());
+		TArray<uint8, TInlineAllocator<256>> Row;
+		Row.SetNumZeroed(InDestSize.X);
+		for (int32 RowIndex = 0; RowIndex < NumRows; RowIndex++)
+		{
+			if (RowStarts[RowIndex] == RowStarts[RowIndex + 1])
+			{
+				OutData.RowOffsets.Add(OutData.Spans.Num());
+				continue;
+			}
+			for (int32 Sorted = RowStarts[RowIndex]; Sorted < RowStarts[RowIndex + 1]; Sorted++)
+			{
+				Row[VoxelXs[RowVoxels[Sorted]]] = InModel.Voxels[RowVoxels[Sorted] * 4 + 3];
+			}
+			AddRowSpans(Row.GetData(), InDestSize.X, RowIndex % InDestSize.Y, RowIndex / InDestSize.Y, OutData);
+			for (int32 Sorted = RowStarts[RowIndex]; Sorted < RowStarts[RowIndex + 1]; Sorted++)
+			{
+				Row[VoxelXs[RowVoxels[Sorted]]] = 0;
+			}
+		}
+	}
+
+	template<int32 Permutation, int32 DestAxis>
+	static constexpr int32 Axis()
+	{
+		return SourceAxes[Permutation / 8][DestAxis];
+	}
+
+	template<int32 Permutation, int32 DestAxis>
+	static constexpr int32 Sign()
+	{
+		return (Permutation >> DestAxis) & 1 ? -1 : 1;
+	}
+
+	// dest = Sign * source + translation on every axis, axis and sign are compile time
+	template<int32 Permutation>
+	static void UnifyPermuted(const MagicaVox::FMagicaVoxModel& InModel, const FIntVector& InTranslation, FUnifyScratch& OutData)
+	{
+		const FIntVector DestSize(InModel.Size[Axis<Permutation, 0>()], InModel.Size[Axis<Permutation, 1>()], InModel.Size[Axis<Permutation, 2>()]);
+		EncodeVoxelList(InModel, DestSize, [&](int32 X, int32 Y, int32 Z, FIntVector& OutDest)
+		{
+			const int32 Source[3] = { X, Y, Z };
+			OutDest.X = Sign<Permutation, 0>() * Source[Axis<Permutation, 0>()] + InTranslation.X;
+			OutDest.Y = Sign<Permutation, 1>() * Source[Axis<Permutation, 1>()] + InTranslation.Y;
+			OutDest.Z = Sign<Permutation, 2>() * Source[Axis<Permutation, 2>()] + InTranslation.Z;
+			return true;
+		}, OutData);
+	}
+
+	using FUnifyPermutedFunction = void(*)(const MagicaVox::FMagicaVoxModel&, const FIntVector&, FUnifyScratch&);
+
+	template<int32... Permutations>
+	static const FUnifyPermutedFunction* GetPermutedTable(TIntegerSequence<int32, Permutations...>)
+	{
+		static const FUnifyPermutedFunction Table[] = { &UnifyPermuted<Permutations>... };
+		return Table;
+	}
+}
+
+bool MagicaVox::GetUnifiedTransform(const FIntVector& InModelSize, const FMatrix44f& InMatrix, FVoxelIntBox& OutBounds, FMatrix44f& OutIndexMatrix)
+{
+	if (InModelSize.GetMin() <= 0)
+	{
+		return false;
+	}
+
+	const uint32 SizeX = InModelSize.X;
+	const uint32 SizeY = InModelSize.Y;
+	const uint32 SizeZ = InModelSize.Z;
+	const FVector4f LocalHalfSize = FVector4f(SizeX * 0.5f, SizeY * 0.5f, SizeZ * 0.5f, 0.f);
+	FVector4f WorldHalfSize = InMatrix.TransformVector(LocalHalfSize);
+	WorldHalfSize.X = FMath::Abs(WorldHalfSize.X);
+	WorldHalfSize.Y = FMath::Abs(WorldHalfSize.Y);
+	WorldHalfSize.Z = FMath::Abs(WorldHalfSize.Z);
+	// main idea is the real center is not affected by rotation, shift it with desired rotation offset.
+	// defaul axis, x = 1, y = 1, z = 1. 
+	static const FVector4f DefaultVoxelPivotVec(FVector4f(-0.5f, -0.5f, -0.5f, 0.f));			
+	const FVector4f LocalObjectPivotVec(FMath::Frac(LocalHalfSize.X), FMath::Frac(LocalHalfSize.Y), FMath::Frac(LocalHalfSize.Z), 0.f);
+	const FVector4f LocalObjectCenterToOriginVoxelCenter(-FMath::Floor(LocalHalfSize.X) + 0.5f, -FMath::Floor(LocalHalfSize.Y) + 0.5f, -FMath::Floor(LocalHalfSize.Z) + 0.5f, 0.f);
+	const FVector4f WorldObjectCenterPos(InMatrix.M[3][0], InMatrix.M[3][1], InMatrix.M[3][2], 1.f);
+	const FVector4f WorldObjectPivotVec = InMatrix.TransformVector(LocalObjectPivotVec);
+	const FVector4f WorldObjectCenterToOriginVoxelCenter = InMatrix.TransformVector(LocalObjectCenterToOriginVoxelCenter);
+	//
+	const FVector4f UnifiedOrigin = WorldObjectCenterPos + WorldObjectPivotVec - WorldHalfSize;
+	const FVector4f UnifiedTranslation = WorldObjectCenterPos + WorldObjectCenterToOriginVoxelCenter + DefaultVoxelPivotVec;
+	OutIndexMatrix = InMatrix;
+	OutIndexMatrix.M[3][0] = UnifiedTranslation.X - UnifiedOrigin.X;
+	OutIndexMatrix.M[3][1] = UnifiedTranslation.Y - UnifiedOrigin.Y;
+	OutIndexMatrix.M[3][2] = UnifiedTranslation.Z - UnifiedOrigin.Z;
+	//
+	OutBounds = FVoxelIntBox(FIntVector(UnifiedOrigin.X, UnifiedOrigin.Y, UnifiedOrigin.Z), FIntVector(UnifiedOrigin.X + WorldHalfSize.X * 2, UnifiedOrigin.Y + WorldHalfSize.Y * 2, UnifiedOrigin.Z + WorldHalfSize.Z * 2));
+	return true;
+}
+
+bool MagicaVox::UnifyModelData(const FMagicaVoxModel& InModel, const FMatrix44f& InMatrix, FMagicaVoxelArena& InArena, FMagicaVoxSpanData& OutData)
 {
-	TArray<uint8> Bytes;
-	if (!FFileHelper::LoadFileToArray(Bytes, *Filename))
+	FVoxelIntBox Bounds;
+	FMatrix44f IndexMatrix;
+	if (!GetUnifiedTransform(InModel.Size, InMatrix, Bounds, IndexMatrix))
 	{
-		FMessageDialog::Open(EAppMsgType::Ok, FText::FromString(TEXT("Error when opening the file")));
 		return false;
 	}
 
-	const ogt_vox_scene* Scene = ogt_vox_read_scene(Bytes.GetData(), Bytes.Num());
-	if (!Scene)
+	MagicaVoxUnify::FUnifyScratch& Data = MagicaVoxUnify::GetUnifyScratch();
+	int32 Permutation;
+	if (MagicaVoxUnify::GetAxisPermutation(IndexMatrix, Permutation))
 	{
-		FMessageDialog::Open(EAppMsgType::Ok, FText::FromString(TEXT("Error when decoding the scene")));
-		return false;
+		const FIntVector Translation(IndexMatrix.M[3][0], IndexMatrix.M[3][1], IndexMatrix.M[3][2]);
+		MagicaVoxUnify::GetPermutedTable(TMakeIntegerSequence<int32, MagicaVoxUnify::NumPermutations>())[Permutation](InModel, Translation, Data);
 	}
-
-	ON_SCOPE_EXIT
+	else
 	{
-		ogt_vox_destroy_scene(Scene);
-	};
+		// generic transform, every voxel goes through the float index matrix
+		const FIntVector DestSize = Bounds.Size();
+		if (DestSize.GetMax() > MAX_uint16)
+		{
+			return false;
+		}
+		MagicaVoxUnify::EncodeVoxelList(InModel, DestSize, [&](int32 X, int32 Y, int32 Z, FIntVector& OutDest)
+		{
+			FVector4f NewIndex = IndexMatrix.TransformPosition(FVector4f(X, Y, Z, 1.f));
+			OutDest = FIntVector(FMath::TruncToInt(NewIndex.X), FMath::TruncToInt(NewIndex.Y), FMath::TruncToInt(NewIndex.Z));
+			return OutDest.X >= 0 && OutDest.Y >= 0 && OutDest.Z >= 0 && OutDest.X < DestSize.X && OutDest.Y < DestSize.Y && OutDest.Z < DestSize.Z;
+		}, Data);
+	}
+	Data.RowOffsets.Add(Data.Spans.Num());
 
-	const auto Models = TArrayView<const ogt_vox_model*>(Scene->models, Scene->num_models);
-	if (Models.Num() == 0)
+	// exact sizes are only known now, the payload is three arena allocations
+	OutData.Size = Data.Size;
+	OutData.RowOffsets = InArena.AllocArray<uint32>(Data.RowOffsets.Num());
+	OutData.Spans = InArena.AllocArray<FMagicaVoxSpan>(Data.Spans.Num());
+	OutData.Colors = InArena.AllocArray<uint8>(Data.Colors.Num());
+	FMemory::Memcpy(OutData.RowOffsets.GetData(), Data.RowOffsets.GetData(), Data.RowOffsets.NumBytes());
+	FMemory::Memcpy(OutData.Spans.GetData(), Data.Spans.GetData(), Data.Spans.NumBytes());
+	FMemory::Memcpy(OutData.Colors.GetData(), Data.Colors.GetData(), Data.Colors.NumBytes());
+	if (Data.GetAllocatedSize() > MagicaVoxUnify::MaxUnifyScratchSize)
 	{
-		FMessageDialog::Open(EAppMsgType::Ok, FText::FromString(TEXT("No models in the file")));
-		return false;
+		Data = MagicaVoxUnify::FUnifyScratch();
 	}
-	
-	// import all instance with transform
-	if (!ImportPool.IsValid())
+	return true;
+}
+
+void MagicaVox::FMagicaVoxTileWriter::Begin(int32 InMinX, int32 InMinY, int32 InMaxX, int32 InMaxY, int32 InZ)
+{
+	check(InMaxX - InMinX <= TileSize && InMaxY - InMinY <= TileSize);
+	MinX = InMinX;
+	MinY = InMinY;
+	MaxX = InMaxX;
+	MaxY = InMaxY;
+	Z = InZ;
+}
+
+void MagicaVox::FMagicaVoxTileWriter::Flush()
+{
+	// magica X is the asset's Y, so every tile row is one contiguous run of magica Y in the tile and in the asset
+	const FIntVector& AssetSize = AssetData.GetSize();
+	const int32 NumY = MaxY - MinY;
+	FVoxelValue* AssetValues = AssetData.GetRawValues().GetData();
+	// imports size the asset with materials, an asset that still has none only gets values
+	FVoxelMaterial* AssetMaterials = AssetData.GetRawMaterials().Num() == AssetData.GetRawValues().Num() ? AssetData.GetRawMaterials().GetData() : nullptr;
+	for (int32 X = MinX; X < MaxX; X++)
 	{
-		ImportPool = FMagicaVoxelQueuedThreadPool::Create(ImportThreads, 1024 * 1024, EThreadPriority::TPri_Normal);
-		check(ImportPool.IsValid());
+		const int64 AssetIndex = MinY + AssetSize.X * (X + int64(AssetSize.Y) * Z);
+		checkSlow(AssetIndex + NumY <= AssetData.GetRawValues().Num());
+		const int32 Index = GetIndex(X - MinX, 0);
+		FMemory::Memcpy(AssetValues + AssetIndex, Values + Index, NumY * sizeof(FVoxelValue));
+		if (AssetMaterials)
+		{
+			FMemory::Memcpy(AssetMaterials + AssetIndex, Materials + Index, NumY * sizeof(FVoxelMaterial));
+		}
 	}
-	TPair<FVoxelIntBox, TArray<uint8>> SceneData;
-	if (MergeSceneData(Scene, SceneData))
+}
+
+void MagicaVox::FMagicaVoxTileWriter::SetValue(int32 X, int32 Y, const FVoxelValue& Value)
+{
+	checkSlow(IsInTile(X, Y));
+	Values[GetIndex(X - MinX, Y - MinY)] = Value;
+}
+
+void MagicaVox::FMagicaVoxTileWriter::SetMaterial(int32 X, int32 Y, const FVoxelMaterial& Material)
+{
+	checkSlow(IsInTile(X, Y));
+	Materials[GetIndex(X - MinX, Y - MinY)] = Material;
+}
+
+void MagicaVox::FMagicaVoxHexOccupancy::Init(const FMagicaVoxSceneData& InSceneData, const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
+{
+	Reset();
+	InSetting.InitForMultiThread();
+	SceneData = &InSceneData;
+	SceneSize = InSceneData.GetSize();
+	Period = FIntPoint(InSetting.HalfWidth * 3, InSetting.GetHalfHeight() * 2);
+	check(Period.X > 0 && Period.Y > 0);
+	NumTiles = FIntPoint(FMath::DivideAndRoundUp(SceneSize.X, Period.X), FMath::DivideAndRoundUp(SceneSize.Y, Period.Y));
+	// same offsets as GetCenter and GetBorderClockPos: straight and diagonal centers, then the 4 side neighbours of each.
+	// top and bottom neighbours are one period away so they share the center's site
+	const int32 halfHeight = InSetting.GetHalfHeight();
+	const int32 quarterWidth = floor(InSetting.HalfWidth * 0.5);
+	const int32 oneColumnOffset = InSetting.HalfWidth * 1.5;
+	const FIntPoint Centers[] = { FIntPoint(InSetting.HalfWidth, halfHeight), FIntPoint(-quarterWidth, 0) };
+	SiteIndices.Init(INDEX_NONE, Period.X * Period.Y);
+	for (const FIntPoint& Center : Centers)
 	{
-		ImportPool->AddQueuedWorks(FMagicaVoxImportWork::Create(Asset, SceneData, ImportThreads, InSetting));
-		while (ImportPool->IsWorking())
+		for (const FIntPoint& Offset : { FIntPoint(0, 0), FIntPoint(oneColumnOffset, halfHeight), FIntPoint(oneColumnOffset, -halfHeight), FIntPoint(-oneColumnOffset, -halfHeight), FIntPoint(-oneColumnOffset, halfHeight) })
 		{
-			FPlatformProcess::Sleep(0.0f);
+			const FIntPoint Site(((Center.X + Offset.X) % Period.X + Period.X) % Period.X, ((Center.Y + Offset.Y) % Period.Y + Period.Y) % Period.Y);
+			int32& SiteIndex = SiteIndices[Site.X + Period.X * Site.Y];
+			if (SiteIndex == INDEX_NONE)
+			{
+				SiteIndex = Sites.Add(Site);
+			}
 		}
 	}
-	else
+	WordsPerLayer = FMath::DivideAndRoundUp(NumTiles.X * NumTiles.Y * Sites.Num(), 32);
+	Bits.SetNumZeroed(int64(WordsPerLayer) * SceneSize.Z);
+}
+
+bool MagicaVox::FMagicaVoxHexOccupancy::SetBits(TArrayView<const uint32> InBits)
+{
+	if (InBits.Num() != Bits.Num())
 	{
-		FMessageDialog::Open(EAppMsgType::Ok, FText::FromString(FString::Printf(TEXT("failed to merge scene"))));
 		return false;
 	}
-	
+	FMemory::Memcpy(Bits.GetData(), InBits.GetData(), Bits.NumBytes());
 	return true;
 }
 
-// import all instance with transform, modify marching cube value to render regular hexagon
-bool MagicaVox::MergeSceneData(const ogt_vox_scene* InScene, TPair<FVoxelIntBox, TArray<uint8>>& OutData)
+uint64 MagicaVox::FMagicaVoxHexOccupancy::HashSetting(const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
 {
-	if (InScene == nullptr)
+	// sites and periods only depend on the hexagon size
+	InSetting.InitForMultiThread();
+	return (uint64(uint32(InSetting.HalfWidth)) << 32) | uint32(InSetting.GetHalfHeight());
+}
+
+void MagicaVox::FMagicaVoxHexOccupancy::Reset()
+{
+	SceneData = nullptr;
+	Sites.Empty();
+	SiteIndices.Empty();
+	Bits.Empty();
+}
+
+TArray<IMagicaVoxelQueuedWork*> MagicaVox::FMagicaVoxHexOccupancy::CreateWorks(FMagicaVoxelArena& InArena, int32 InMinZ, int32 InMaxZ)
+{
+	static constexpr int32 LayersPerWork = 4;
+	const int32 MaxZ = FMath::Min(InMaxZ, SceneSize.Z);
+	TArray<IMagicaVoxelQueuedWork*> Works;
+	for (int32 MinZ = InMinZ; MinZ < MaxZ; MinZ += LayersPerWork)
 	{
-		return false;
+		Works.Add(new (InArena) FMagicaVoxLambdaWork("FMagicaVoxOccupancyWork", [this, MinZ, MaxZ]()
+		{
+			for (int32 Z = MinZ; Z < FMath::Min(MinZ + LayersPerWork, MaxZ); Z++)
+			{
+				BuildLayer(Z);
+			}
+		}));
 	}
+	return Works;
+}
 
-	const auto Instances = TArrayView<const ogt_vox_instance>(InScene->instances, InScene->num_instances);
-	const auto Models = TArrayView<const ogt_vox_model*>(InScene->models, InScene->num_models);
-	TMap<FVoxelIntBox, TArray<FUintVector4>> InstMap;
-	FVoxelIntBox SceneBounds;
-	for (const auto& Inst : Instances)
+void MagicaVox::FMagicaVoxHexOccupancy::BuildLayer(int32 Z)
+{
+	uint32* Layer = Bits.GetData() + int64(Z) * WordsPerLayer;
+	for (int32 TileY = 0; TileY < NumTiles.Y; TileY++)
 	{
-		TPair<FVoxelIntBox, TArray<FUintVector4>> Temp;
-		FMatrix44f Matrix(FPlane4f(Inst.transform.m00, Inst.transform.m01, Inst.transform.m02, Inst.transform.m03)
-			, FPlane4f(Inst.transform.m10, Inst.transform.m11, Inst.transform.m12, Inst.transform.m13)
-			, FPlane4f(Inst.transform.m20, Inst.transform.m21, Inst.transform.m22, Inst.transform.m23)
-			, FPlane4f(Inst.transform.m30, Inst.transform.m31, Inst.transform.m32, Inst.transform.m33));
-		if (Models.IsValidIndex(Inst.model_index) && UnifyModelData(Models[Inst.model_index], Matrix, Temp))
-		{
-			SceneBounds = SceneBounds + Temp.Key;
-			InstMap.Add(MoveTemp(Temp));
-		}
-		else
+		for (int32 TileX = 0; TileX < NumTiles.X; TileX++)
 		{
-			FMessageDialog::Open(EAppMsgType::Ok, FText::FromString(FString::Printf(TEXT("failed to import model index[%d] at transofrom[%s]"), Inst.model_index, *Matrix.ToString())));
-			return false;
+			for (int32 Site = 0; Site < Sites.Num(); Site++)
+			{
+				const int32 X = TileX * Period.X + Sites[Site].X;
+				const int32 Y = TileY * Period.Y + Sites[Site].Y;
+				if (X < SceneSize.X && Y < SceneSize.Y && SceneData->Get(X, Y, Z) != 0)
+				{
+					const int32 Bit = (TileX + NumTiles.X * TileY) * Sites.Num() + Site;
+					Layer[Bit >> 5] |= 1u << (Bit & 31);
+				}
+			}
 		}
 	}
-	//
-	TArray<uint8> VoxelData;
-	VoxelData.SetNum(SceneBounds.Count());
-	//
-	ImportPool->AddQueuedWorks(FMagicaVoxMergeWork::Create(VoxelData, SceneBounds, InstMap));
-	while (ImportPool->IsWorking())
+}
+
+TSharedRef<const MagicaVox::FMagicaVoxImportWork::FHexTable, ESPMode::ThreadSafe> MagicaVox::FMagicaVoxImportWork::CreateHexTable(const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
+{
+	// every center lands on the same offset one period further, so one period covers the whole scene
+	const TSharedRef<FHexTable, ESPMode::ThreadSafe> Table = MakeShared<FHexTable, ESPMode::ThreadSafe>();
+	Table->Period = FIntPoint(InSetting.HalfWidth * 3, InSetting.GetHalfHeight() * 2);
+	check(Table->Period.X > 0 && Table->Period.Y > 0);
+	Table->Entries.SetNumUninitialized(Table->Period.X * Table->Period.Y);
+	for (int32 Y = 0; Y < Table->Period.Y; Y++)
 	{
-		FPlatformProcess::Sleep(0.0f);
+		for (int32 X = 0; X < Table->Period.X; X++)
+		{
+			const FVector Current(X, Y, 0.f);
+			FVector Center = GetCenter(InSetting, Current, false);
+			if (IsInbound(InSetting, Center, Current) != 1)
+			{
+				Center = GetCenter(InSetting, Current, true);		// try diagonal
+			}
+			FHexEntry& Entry = Table->Entries[X + Table->Period.X * Y];
+			Entry.CenterX = FMath::RoundToInt(Center.X) - X;
+			Entry.CenterY = FMath::RoundToInt(Center.Y) - Y;
+			Entry.Inbound = IsInbound(InSetting, Center, Current);
+			Entry.ClockPos = GetRawClockPos(InSetting, Center, Current);
+		}
 	}
-
-	OutData = TPair<FVoxelIntBox, TArray<uint8>>(MoveTemp(SceneBounds), MoveTemp(VoxelData));
-	return true;
+	return Table;
 }
 
-bool MagicaVox::UnifyModelData(const ogt_vox_model* InModel, const FMatrix44f& InMatrix, TPair<FVoxelIntBox, TArray<FUintVector4>>& OutData)
+TArray<IMagicaVoxelQueuedWork*> MagicaVox::FMagicaVoxImportWork::Create(FMagicaVoxelArena& InArena, FVoxelDataAssetData& InAssetData, const FMagicaVoxSceneData& InSceneData, const FMagicaVoxHexOccupancy& InOccupancy, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, const TBitArray<>* InDirtyBricks, int32 InImport)
 {
-	if (InModel == nullptr || InModel->voxel_data == nullptr)
+	InSetting.InitForMultiThread();
+	const TSharedRef<const FHexTable, ESPMode::ThreadSafe> HexTable = CreateHexTable(InSetting);
+	const int32 CaptureZ = FMagicaVoxDebugCapture::GetCaptureLevel();
+	TArray<IMagicaVoxelQueuedWork*> Works;
+	FIntVector Size = InSceneData.GetSize();
+	if (!InDirtyBricks)
 	{
-		return false;
+		InAssetData.SetSize(FIntVector(Size.Y, Size.X, Size.Z), true, true);			// MagicaVoxe and UE use different coordination
 	}
-
-	const uint32 SizeX = InModel->size_x;
-	const uint32 SizeY = InModel->size_y;
-	const uint32 SizeZ = InModel->size_z;
-	const FVector4f LocalHalfSize = FVector4f(SizeX * 0.5f, SizeY * 0.5f, SizeZ * 0.5f, 0.f);
-	FVector4f WorldHalfSize = InMatrix.TransformVector(LocalHalfSize);
-	WorldHalfSize.X = FMath::Abs(WorldHalfSize.X);
-	WorldHalfSize.Y = FMath::Abs(WorldHalfSize.Y);
-	WorldHalfSize.Z = FMath::Abs(WorldHalfSize.Z);
-	// main idea is the real center is not affected by rotation, shift it with desired rotation offset.
-	// defaul axis, x = 1, y = 1, z = 1. 
-	static const FVector4f DefaultVoxelPivotVec(FVector4f(-0.5f, -0.5f, -0.5f, 0.f));			
-	const FVector4f LocalObjectPivotVec(FMath::Frac(LocalHalfSize.X), FMath::Frac(LocalHalfSize.Y), FMath::Frac(LocalHalfSize.Z), 0.f);
-	const FVector4f LocalObjectCenterToOriginVoxelCenter(-FMath::Floor(LocalHalfSize.X) + 0.5f, -FMath::Floor(LocalHalfSize.Y) + 0.5f, -FMath::Floor(LocalHalfSize.Z) + 0.5f, 0.f);
-	const FVector4f WorldObjectCenterPos(InMatrix.M[3][0], InMatrix.M[3][1], InMatrix.M[3][2], 1.f);
-	const FVector4f WorldObjectPivotVec = InMatrix.TransformVector(LocalObjectPivotVec);
-	const FVector4f WorldObjectCenterToOriginVoxelCenter = InMatrix.TransformVector(LocalObjectCenterToOriginVoxelCenter);
-	//
-	const FVector4f UnifiedOrigin = WorldObjectCenterPos + WorldObjectPivotVec - WorldHalfSize;
-	const FVector4f UnifiedTranslation = WorldObjectCenterPos + WorldObjectCenterToOriginVoxelCenter + DefaultVoxelPivotVec;
-	FMatrix44f IndexMatrix(InMatrix);
-	IndexMatrix.M[3][0] = UnifiedTranslation.X - UnifiedOrigin.X;
-	IndexMatrix.M[3][1] = UnifiedTranslation.Y - UnifiedOrigin.Y;
-	IndexMatrix.M[3][2] = UnifiedTranslation.Z - UnifiedOrigin.Z;
-	//
-	FVoxelIntBox Bounds(FIntVector(UnifiedOrigin.X, UnifiedOrigin.Y, UnifiedOrigin.Z), FIntVector(UnifiedOrigin.X + WorldHalfSize.X * 2, UnifiedOrigin.Y + WorldHalfSize.Y * 2, UnifiedOrigin.Z + WorldHalfSize.Z * 2));
-	TArray<FUintVector4> Data;
-	for (uint32 Z = 0; Z < SizeZ; Z++)
+	// one work per scene brick, the pool balances them with work stealing
+	// works only write their own cells, neighbour contributions are classified again in an X halo
+	const FIntVector& NumBricks = InSceneData.GetNumBricks();
+	Works.Reserve(NumBricks.X * NumBricks.Y * NumBricks.Z);
+	for (int32 Z = 0; Z < NumBricks.Z; Z++)
 	{
-		for (uint32 Y = 0; Y < SizeY; Y++)
+		for (int32 Y = 0; Y < NumBricks.Y; Y++)
 		{
-			for (uint32 X = 0; X < SizeX; X++)
+			for (int32 X = 0; X < NumBricks.X; X++)
 			{
-				const uint32 OldIndex = X + SizeX * Y + SizeX * SizeY * Z;
-				const uint8 Voxel = InModel->voxel_data[OldIndex];
-				FVector4f NewIndex = IndexMatrix.TransformPosition(FVector4f(X, Y, Z, 1.f));
-				Data.Emplace(NewIndex.X, NewIndex.Y, NewIndex.Z, Voxel);
+				if (InDirtyBricks && !(*InDirtyBricks)[X + NumBricks.X * (Y + NumBricks.Y * Z)])
+				{
+					continue;
+				}
+				const FIntVector Min = FIntVector(X, Y, Z) * FMagicaVoxSceneData::BrickSize;
+				const FIntVector Max(FMath::Min(Min.X + FMagicaVoxSceneData::BrickSize, Size.X), FMath::Min(Min.Y + FMagicaVoxSceneData::BrickSize, Size.Y), FMath::Min(Min.Z + FMagicaVoxSceneData::BrickSize, Size.Z));
+				Works.Add(new (InArena) FMagicaVoxImportWork(InAssetData, InSceneData, InOccupancy, FVoxelIntBox(Min, Max), InSetting, HexTable, CaptureZ, InImport));
 			}
 		}
 	}
+	return MoveTemp(Works);
+}
 
-	OutData = TPair<FVoxelIntBox, TArray<FUintVector4>>(MoveTemp(Bounds), MoveTemp(Data));
-	return true;
+uint64 MagicaVox::FMagicaVoxImportWork::HashSetting(const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
+{
+	InSetting.InitForMultiThread();
+	uint64 Hash = FMagicaVoxHexOccupancy::HashSetting(InSetting);
+	// whatever the options behind it, the table is what classification reads
+	for (const auto& Entry : InSetting.VoxelValueByHeight)
+	{
+		Hash = CityHash64WithSeed(reinterpret_cast<const char*>(&Entry), sizeof(Entry), Hash);
+	}
+	return Hash;
 }
 
-TArray<IMagicaVoxelQueuedWork*> MagicaVox::FMagicaVoxImportWork::Create(FVoxelDataAssetData& InAssetData, const TPair<FVoxelIntBox, TArray<uint8>>& InSceneData, uint32 InNumThreads, const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
+TBitArray<> MagicaVox::FMagicaVoxImportWork::GetDirtyBricks(const FMagicaVoxSceneData& InSceneData, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, const TBitArray<>& InChangedBricks)
 {
 	InSetting.InitForMultiThread();
-	TArray<IMagicaVoxelQueuedWork*> Works;
-	FIntVector Size = InSceneData.Key.Size();
-	InAssetData.SetSize(FIntVector(Size.Y, Size.X, Size.Z), true, true);			// MagicaVoxe and UE use different coordination
-	FIntVector PrevMin(0, 0, 0);
-	uint32 Max = Size.GetMax();
-	if (Max > InNumThreads)
+	// a changed voxel changes the occupancy of its hexagon, which is read by voxels whose center or center's neighbour it is.
+	// two periods plus the X neighbour cover that, layers never read each other
+	const FIntPoint Halo(InSetting.HalfWidth * 6 + 1, InSetting.GetHalfHeight() * 4 + 1);
+	const FIntPoint HaloBricks(FMath::DivideAndRoundUp(Halo.X, FMagicaVoxSceneData::BrickSize), FMath::DivideAndRoundUp(Halo.Y, FMagicaVoxSceneData::BrickSize));
+	const FIntVector& NumBricks = InSceneData.GetNumBricks();
+	TBitArray<> Dirty(false, InChangedBricks.Num());
+	for (TConstSetBitIterator<> It(InChangedBricks); It; ++It)
 	{
-		uint32 EachSize = Max / InNumThreads;
-		for (uint32 i = 1; i < InNumThreads; i++)
+		const int32 X = It.GetIndex() % NumBricks.X;
+		const int32 Y = (It.GetIndex() / NumBricks.X) % NumBricks.Y;
+		const int32 Z = It.GetIndex() / (NumBricks.X * NumBricks.Y);
+		for (int32 DirtyY = FMath::Max(Y - HaloBricks.Y, 0); DirtyY <= FMath::Min(Y + HaloBricks.Y, NumBricks.Y - 1); DirtyY++)
 		{
-			uint32 CurSize = EachSize * i;
-			FIntVector TempMax(Max == Size.X ? CurSize : Size.X, Max == Size.Y ? CurSize : Size.Y, Max == Size.Z ? CurSize : Size.Z);
-			Works.Add(new FMagicaVoxImportWork(InAssetData, InSceneData.Value, FVoxelIntBox(PrevMin, TempMax), Size, InSetting));
-			PrevMin = FIntVector(Max == Size.X ? CurSize : 0, Max == Size.Y ? CurSize : 0, Max == Size.Z ? CurSize : 0);
+			for (int32 DirtyX = FMath::Max(X - HaloBricks.X, 0); DirtyX <= FMath::Min(X + HaloBricks.X, NumBricks.X - 1); DirtyX++)
+			{
+				Dirty[DirtyX + NumBricks.X * (DirtyY + NumBricks.Y * Z)] = true;
+			}
 		}
 	}
-	Works.Add(new FMagicaVoxImportWork(InAssetData, InSceneData.Value, FVoxelIntBox(PrevMin, Size), Size, InSetting));
-	return MoveTemp(Works);
+	return Dirty;
 }
 
-FVector MagicaVox::FMagicaVoxImportWork::GetCenter(const FVector& v, bool bDiagonal) const
+FVector MagicaVox::FMagicaVoxImportWork::GetCenter(const FVoxelDataAssetImportSettings_MagicaVox& Setting, const FVector& v, bool bDiagonal)
 {
 #if 1 // [KidsReturn]
 	const int32 halfHeight = Setting.GetHalfHeight();
@@ -404,7 +1965,7 @@ FVector MagicaVox::FMagicaVoxImportWork::GetCenter(const FVector& v, bool bDiago
 	return bDiagonal ? FVector(xDiagStep * twoColumnOffset - quarterWidth, yDiagStep * twoRowOffset, v.Z) : FVector(xStep * twoColumnOffset + Setting.HalfWidth, yStep * twoRowOffset + halfHeight, v.Z);
 }
 
-int32 MagicaVox::FMagicaVoxImportWork::IsInbound(const FVector& c, const FVector& v) const
+int32 MagicaVox::FMagicaVoxImportWork::IsInbound(const FVoxelDataAssetImportSettings_MagicaVox& Setting, const FVector& c, const FVector& v)
 {
 #if 1 // [KidsReturn]
 	const int32 halfHeight = Setting.GetHalfHeight();
@@ -429,11 +1990,11 @@ int32 MagicaVox::FMagicaVoxImportWork::IsInbound(const FVector& c, const FVector
 	}
 }
 
-int32 MagicaVox::FMagicaVoxImportWork::GetBorderClockPos(FVector& c, const FVector& v) const
+int32 MagicaVox::FMagicaVoxImportWork::GetRawClockPos(const FVoxelDataAssetImportSettings_MagicaVox& Setting, const FVector& c, const FVector& v)
 {
 	// here we figure out points shared by 3 hexagon : 1, 3, 5, 7, 9, 11. others are shared by 2 hexagon. P.S. base on flat-top
 	// 0 means invalid.
-	float b = IsInbound(c, v);
+	float b = IsInbound(Setting, c, v);
 	if (b == 1)
 	{
 #if 1 // [KidsReturn]
@@ -475,180 +2036,364 @@ int32 MagicaVox::FMagicaVoxImportWork::GetBorderClockPos(FVector& c, const FVect
 				cp = bLeft ? 8 : 4;
 			}
 		}
+		return cp;
+	}
+	return 0;
+}
+
+int32 MagicaVox::FMagicaVoxImportWork::GetBorderClockPos(FVector& c, int32 cp) const
+{
+	const int32 halfHeight = Setting.GetHalfHeight();
 #if 1 // [KidsReturn] base on pos above, validate center and convert if needed
-		int32 Idx = c.X + SceneSize.X * c.Y + SceneSize.X * SceneSize.Y * c.Z;
-		if (MagicaData.IsValidIndex(Idx) && MagicaData[Idx] != 0)
+	if (ProbeOccupancy(int32(c.X), int32(c.Y), int32(c.Z)))
+	{
+		return cp;
+	}
+	else
+	{
+		// shared by 3 hexagon : 1, 3, 5, 7, 9, 11. others are shared by 2 hexagon. P.S. base on flat-top
+		if (cp == 2 || cp == 4 || cp == 8 || cp == 10)
 		{
 			return cp;
 		}
 		else
 		{
-			// shared by 3 hexagon : 1, 3, 5, 7, 9, 11. others are shared by 2 hexagon. P.S. base on flat-top
-			if (cp == 2 || cp == 4 || cp == 8 || cp == 10)
-			{
-				return cp;
-			}
-			else
+			const int32 oneRowOffset = halfHeight;
+			const int32 twoRowOffset = halfHeight * 2;
+			const int32 oneColumnOffset = Setting.HalfWidth * 1.5;
+			// top
+			if (cp == 11 || cp == 12 || cp == 1)
 			{
-				const int32 oneRowOffset = halfHeight;
-				const int32 twoRowOffset = halfHeight * 2;
-				const int32 oneColumnOffset = Setting.HalfWidth * 1.5;
-				// top
-				if (cp == 11 || cp == 12 || cp == 1)
+				const FVector n(c.X, c.Y + twoRowOffset, c.Z);
+				if (ProbeOccupancy(int32(n.X), int32(n.Y), int32(n.Z)))
 				{
-					Idx = c.X + SceneSize.X * (c.Y + twoRowOffset) + SceneSize.X * SceneSize.Y * c.Z;
-					if (MagicaData.IsValidIndex(Idx) && MagicaData[Idx] != 0)
-					{
-						c = FVector(c.X, c.Y + twoRowOffset, c.Z);
-						return cp == 1 ? 5 : (cp == 11 ? 7 : 6);
-					}
+					c = n;
+					return cp == 1 ? 5 : (cp == 11 ? 7 : 6);
 				}
-				// top right
-				if (cp >= 1 && cp <= 3)
+			}
+			// top right
+			if (cp >= 1 && cp <= 3)
+			{
+				const FVector n(c.X + oneColumnOffset, c.Y + oneRowOffset, c.Z);
+				if (ProbeOccupancy(int32(n.X), int32(n.Y), int32(n.Z)))
 				{
-					Idx = (c.X + oneColumnOffset) + SceneSize.X * (c.Y + oneRowOffset) + SceneSize.X * SceneSize.Y * c.Z;
-					if (MagicaData.IsValidIndex(Idx) && MagicaData[Idx] != 0)
-					{
-						c = FVector(c.X + oneColumnOffset, c.Y + oneRowOffset, c.Z);
-						return cp == 1 ? 9 : (cp == 3 ? 7 : 8);
-					}
+					c = n;
+					return cp == 1 ? 9 : (cp == 3 ? 7 : 8);
 				}
-				// bottom right
-				if (cp >= 3 && cp <= 5)
+			}
+			// bottom right
+			if (cp >= 3 && cp <= 5)
+			{
+				const FVector n(c.X + oneColumnOffset, c.Y - oneRowOffset, c.Z);
+				if (ProbeOccupancy(int32(n.X), int32(n.Y), int32(n.Z)))
 				{
-					Idx = (c.X + oneColumnOffset) + SceneSize.X * (c.Y - oneRowOffset) + SceneSize.X * SceneSize.Y * c.Z;
-					if (MagicaData.IsValidIndex(Idx) && MagicaData[Idx] != 0)
-					{
-						c = FVector(c.X + oneColumnOffset, c.Y - oneRowOffset, c.Z);
-						return cp == 3 ? 11 : (cp == 5 ? 9 : 10);
-					}
+					c = n;
+					return cp == 3 ? 11 : (cp == 5 ? 9 : 10);
 				}
-				// bottom
-				if (cp == 5 || cp == 6 || cp == 7)
+			}
+			// bottom
+			if (cp == 5 || cp == 6 || cp == 7)
+			{
+				const FVector n(c.X, c.Y - twoRowOffset, c.Z);
+				if (ProbeOccupancy(int32(n.X), int32(n.Y), int32(n.Z)))
 				{
-					Idx = c.X + SceneSize.X * (c.Y - twoRowOffset) + SceneSize.X * SceneSize.Y * c.Z;
-					if (MagicaData.IsValidIndex(Idx) && MagicaData[Idx] != 0)
-					{
-						c = FVector(c.X, c.Y - twoRowOffset, c.Z);
-						return cp == 5 ? 1 : (cp == 7 ? 11 : 12);
-					}
+					c = n;
+					return cp == 5 ? 1 : (cp == 7 ? 11 : 12);
 				}
-				// bottom left
-				if (cp >= 7 && cp <= 9)
+			}
+			// bottom left
+			if (cp >= 7 && cp <= 9)
+			{
+				const FVector n(c.X - oneColumnOffset, c.Y - oneRowOffset, c.Z);
+				if (ProbeOccupancy(int32(n.X), int32(n.Y), int32(n.Z)))
 				{
-					Idx = (c.X - oneColumnOffset) + SceneSize.X * (c.Y - oneRowOffset) + SceneSize.X * SceneSize.Y * c.Z;
-					if (MagicaData.IsValidIndex(Idx) && MagicaData[Idx] != 0)
-					{
-						c = FVector(c.X - oneColumnOffset, c.Y - oneRowOffset, c.Z);
-						return cp == 7 ? 3 : (cp == 9 ? 1 : 2);
-					}
+					c = n;
+					return cp == 7 ? 3 : (cp == 9 ? 1 : 2);
 				}
-				// top left
-				if (cp >= 9 && cp <= 11)
+			}
+			// top left
+			if (cp >= 9 && cp <= 11)
+			{
+				const FVector n(c.X - oneColumnOffset, c.Y + oneRowOffset, c.Z);
+				if (ProbeOccupancy(int32(n.X), int32(n.Y), int32(n.Z)))
 				{
-					Idx = (c.X - oneColumnOffset) + SceneSize.X * (c.Y + oneRowOffset) + SceneSize.X * SceneSize.Y * c.Z;
-					if (MagicaData.IsValidIndex(Idx) && MagicaData[Idx] != 0)
-					{
-						c = FVector(c.X - oneColumnOffset, c.Y + oneRowOffset, c.Z);
-						return cp == 9 ? 5 : (cp == 11 ? 3 : 4);
-					}
+					c = n;
+					return cp == 9 ? 5 : (cp == 11 ? 3 : 4);
 				}
 			}
 		}
-#endif
 	}
+#endif
 	return 0;
 }
 
 void MagicaVox::FMagicaVoxImportWork::DoThreadedWork()
 {
-	for (int32 Z = Bounds.Min.Z; Z < Bounds.Max.Z; Z++)
+	// classify then write: every work classifies its tile plus one cell on each side along X into local buffers,
+	// then writes every one of its own cells. nothing is written outside the work and nothing is read back from the asset,
+	// so the result doesn't depend on how the scene is tiled, on the number of threads or on what the asset held before
+	static constexpr int32 TileSize = FMagicaVoxTileWriter::TileSize;
+	static constexpr int32 RowSize = TileSize + 2;
+	FClassifiedVoxel Classified[TileSize * RowSize];
+	FMagicaVoxTileWriter Writer(AssetData);
+	for (int32 Z = Bounds.Min.Z; Z < Bounds.Max.Z && !IsCancelled(); Z++)
 	{
-		const bool bShouldLog = CVarLogImport.GetValueOnAnyThread()> 0 && Z == CVarDebugSurfaceLevel.GetValueOnAnyThread();
-		for (int32 Y = Bounds.Min.Y; Y < Bounds.Max.Y; Y++)
+#if MAGICAVOX_DEBUG_CAPTURE
+		const bool bCapture = Z == CaptureZ;
+#else
+		constexpr bool bCapture = false;
+#endif
+		for (int32 TileY = Bounds.Min.Y; TileY < Bounds.Max.Y; TileY += TileSize)
 		{
-			for (int32 X = Bounds.Min.X; X < Bounds.Max.X; X++)
+			for (int32 TileX = Bounds.Min.X; TileX < Bounds.Max.X; TileX += TileSize)
 			{
-				const uint8& V = MagicaData[X + SceneSize.X * Y + SceneSize.X * SceneSize.Y * Z];
-				if (V > 0)
+				const int32 TileMaxX = FMath::Min(TileX + TileSize, Bounds.Max.X);
+				const int32 TileMaxY = FMath::Min(TileY + TileSize, Bounds.Max.Y);
+
+				// classify
+				uint32 NearRows[TileSize];
+				for (int32 Y = TileY; Y < TileMaxY; Y++)
 				{
-					FVoxelValue Value = FVoxelValue::Full();
-					FVector Current = FVector(X, Y, Z);
-					FVector Center = GetCenter(Current, false);
-					if (IsInbound(Center, Current) != 1)
+					// bit i is X = Bounds.Min.X + i - 1, the halo bits come from the neighbour bricks
+					const uint32 Left = MagicaData.GetRowBits(Bounds.Min.X - FMagicaVoxSceneData::BrickSize, Y, Z);
+					const uint32 Right = MagicaData.GetRowBits(Bounds.Min.X + FMagicaVoxSceneData::BrickSize, Y, Z);
+					const uint64 Solid = (uint64(MagicaData.GetRowBits(Bounds.Min.X, Y, Z)) << 1) | (Left >> 31) | (uint64(Right & 1) << 33);
+					const uint64 Halo = (Solid >> (TileX - Bounds.Min.X)) & ((uint64(1) << (TileMaxX - TileX + 2)) - 1);
+					// cells without a solid voxel at X-1, X or X+1 can't get a neighbour contribution, they are plain air
+					NearRows[Y - TileY] = bCapture ? MAX_uint32 : uint32(Halo | (Halo >> 1) | (Halo >> 2));
+
+					FClassifiedVoxel* Row = Classified + RowSize * (Y - TileY);
+					for (int32 Index = 0; Index < TileMaxX - TileX + 2; Index++)
 					{
-						Center = GetCenter(Current, true);		// try diagonal
+						Row[Index] = FClassifiedVoxel();
 					}
-					const int32 CP = GetBorderClockPos(Center, Current);
-					if (CP != 0 && CP != 6 && CP != 12)
+					for (uint64 Pending = Halo; Pending != 0; Pending &= Pending - 1)
 					{
-						// towards right
-						const int32 ShiftX = CP < 6 ? X + 1 : X - 1;		// cp 1-6 is towards right, 7-12 is towards left
-						const int32 Idx = ShiftX + SceneSize.X * Y + SceneSize.X * SceneSize.Y * Z;
-						if (MagicaData.IsValidIndex(Idx) && ShiftX >= 0 && ShiftX < SceneSize.X)
-						{
-							if (MagicaData[Idx] == 0)
-							{
-								const TPair<float, float>& Vox = Setting.VoxelValueByHeight[FMath::Abs(Current.Y - Center.Y)];	// first = inside, second = outside
-								Value = FVoxelValue(Vox.Key);
-								AssetData.SetValue(Y, ShiftX, Z, FVoxelValue(Vox.Value));
-								if (bShouldLog) UE_LOG(LogTemp, Error, TEXT("linfei> DoWorkDual %d %d %d %d %.3f. CP[%d] Center[%s] Dist[%.1f]"), ShiftX, Y, Z, V, AssetData.GetValueUnsafe(Y, ShiftX, Z).ToFloat(), CP, *Center.ToString(), FMath::Abs(Current.Y - Center.Y));
-							}
-						}
-						else if (CP == 3 || CP == 9)
-						{
-							Value = FVoxelValue(0.f);
-						}
+						const int32 Index = FMath::CountTrailingZeros64(Pending);
+						const int32 X = TileX + Index - 1;
+						// halo cells are captured by the work that owns them
+						Row[Index] = ClassifyVoxel(X, Y, Z, MagicaData.Get(X, Y, Z), bCapture && X >= TileX && X < TileMaxX);
 					}
-					AssetData.SetValue(Y, X, Z, Value);
-					if (bShouldLog) UE_LOG(LogTemp, Error, TEXT("linfei> DoWorkFull %d %d %d %d %.3f. CP[%d] Center[%s] Dist[%.1f]"), X, Y, Z, V, AssetData.GetValueUnsafe(Y, X, Z).ToFloat(), CP, *Center.ToString(), FMath::Abs(Current.Y - Center.Y));
+					NumClassified += FMath::CountBits(Halo);
 				}
-				else 
+
+				// write
+				Writer.Begin(TileX, TileY, TileMaxX, TileMaxY, Z);
+				for (int32 Y = TileY; Y < TileMaxY; Y++)
 				{
-					 if (bShouldLog) UE_LOG(LogTemp, Error, TEXT("linfei> DoWorkEmpty %d %d %d %d. IsNull[%d] value[%.3f]"), X, Y, Z, V, AssetData.GetValueUnsafe(Y, X, Z).IsNull(), AssetData.GetValueUnsafe(Y, X, Z).ToFloat());
-					if (AssetData.GetValueUnsafe(Y, X, Z).IsNull())
+					const uint32 Near = NearRows[Y - TileY];
+					const FClassifiedVoxel* Row = Classified + RowSize * (Y - TileY);
+					int32 X = TileX;
+					while (X < TileMaxX)
 					{
-						AssetData.SetValue(Y, X, Z, FVoxelValue::Empty());
+						const uint32 Pending = Near >> (X - TileX);
+						if ((Pending & 1) == 0)
+						{
+							const int32 RunEnd = Pending == 0 ? TileMaxX : FMath::Min<int32>(X + FMath::CountTrailingZeros(Pending), TileMaxX);
+							for (; X < RunEnd; X++)
+							{
+								Writer.SetValue(X, Y, FVoxelValue::Empty());
+								Writer.SetMaterial(X, Y, FVoxelMaterial(ForceInit));
+							}
+							continue;
+						}
+						const int32 Index = X - TileX + 1;
+						ResolveVoxel(Writer, X, Y, Z, Row[Index - 1], Row[Index], Row[Index + 1], bCapture);
+						X++;
 					}
 				}
-				
-				FVoxelMaterial Material(ForceInit);
-				if (V > 0)
-				{
-					Material.SetSingleIndex(V - 1);			// MagicaVoxel index start from 1, we are starting from 0
-				}
-				AssetData.SetMaterial(Y, X, Z, Material);
+				Writer.Flush();
 			}
 		}
 	}
+	if (FMagicaVoxTrace::IsEnabled())
+	{
+		const FIntVector Size = Bounds.Size();
+		FMagicaVoxTrace::AddCounter(EMagicaVoxTraceCounter::Cells, int64(Size.X) * Size.Y * Size.Z);
+		FMagicaVoxTrace::AddCounter(EMagicaVoxTraceCounter::ClassifiedVoxels, NumClassified);
+		FMagicaVoxTrace::AddCounter(EMagicaVoxTraceCounter::BorderVoxels, NumBorderVoxels);
+		FMagicaVoxTrace::AddCounter(EMagicaVoxTraceCounter::NeighbourProbes, NumProbes);
+	}
 
 	delete this;
 }
 
-void MagicaVox::FMagicaVoxImportWork::Abandon()
+MagicaVox::FMagicaVoxImportWork::FClassifiedVoxel MagicaVox::FMagicaVoxImportWork::ClassifyVoxel(int32 X, int32 Y, int32 Z, uint8 Color, bool bCapture) const
+{
+	FClassifiedVoxel Voxel;
+	Voxel.Color = Color;
+	Voxel.Inside = FVoxelValue::Full();
+	FVector Current = FVector(X, Y, Z);
+	const FHexEntry& Hex = HexTable->Get(X, Y);
+	FVector Center = FVector(X + Hex.CenterX, Y + Hex.CenterY, Z);
+	NumBorderVoxels += Hex.Inbound == 1;
+	const int32 CP = Hex.Inbound == 1 ? GetBorderClockPos(Center, Hex.ClockPos) : 0;
+	if (CP != 0 && CP != 6 && CP != 12)
+	{
+		// towards right
+		const int32 ShiftX = CP < 6 ? X + 1 : X - 1;		// cp 1-6 is towards right, 7-12 is towards left
+		if (ShiftX >= 0 && ShiftX < SceneSize.X)
+		{
+			if (MagicaData.Get(ShiftX, Y, Z) == 0)
+			{
+				const TPair<float, float>& Vox = Setting.VoxelValueByHeight[FMath::Abs(Current.Y - Center.Y)];	// first = inside, second = outside
+				Voxel.Inside = FVoxelValue(Vox.Key);
+				Voxel.Outside = FVoxelValue(Vox.Value);
+				Voxel.Shift = ShiftX - X;
+			}
+		}
+		else if (CP == 3 || CP == 9)
+		{
+			Voxel.Inside = FVoxelValue(0.f);
+		}
+	}
+#if MAGICAVOX_DEBUG_CAPTURE
+	if (bCapture)
+	{
+		FMagicaVoxDebugCapture::Add({ CaptureImport, X, Y, Z, float(Center.X), float(Center.Y), Voxel.Inside.ToFloat(), Voxel.Outside.ToFloat(), Color, int8(CP), Voxel.Shift, FMagicaVoxDebugRecord::EKind::Voxel, 0 });
+	}
+#endif
+	return Voxel;
+}
+
+void MagicaVox::FMagicaVoxImportWork::ResolveVoxel(FMagicaVoxTileWriter& Writer, int32 X, int32 Y, int32 Z, const FClassifiedVoxel& Left, const FClassifiedVoxel& Voxel, const FClassifiedVoxel& Right, bool bCapture) const
 {
+	if (Voxel.Color > 0)
+	{
+		Writer.SetValue(X, Y, Voxel.Inside);
+	}
+	else if (Right.Color > 0 && Right.Shift < 0)
+	{
+		// the right neighbour used to be imported last, its contribution wins
+		Writer.SetValue(X, Y, Right.Outside);
+	}
+	else if (Left.Color > 0 && Left.Shift > 0)
+	{
+		Writer.SetValue(X, Y, Left.Outside.IsNull() ? FVoxelValue::Empty() : Left.Outside);
+	}
+	else
+	{
+		// written even over an old value, incremental imports rewrite bricks in place
+		Writer.SetValue(X, Y, FVoxelValue::Empty());
+	}
+#if MAGICAVOX_DEBUG_CAPTURE
+	if (bCapture && Voxel.Color == 0)
+	{
+		const FVoxelValue Value = Right.Color > 0 && Right.Shift < 0 ? Right.Outside : (Left.Color > 0 && Left.Shift > 0 && !Left.Outside.IsNull() ? Left.Outside : FVoxelValue::Empty());
+		const uint8 Flags = (Left.Color > 0 && Left.Shift > 0 ? 1 : 0) | (Right.Color > 0 && Right.Shift < 0 ? 2 : 0);
+		FMagicaVoxDebugCapture::Add({ CaptureImport, X, Y, Z, 0.f, 0.f, Value.ToFloat(), 0.f, 0, 0, 0, FMagicaVoxDebugRecord::EKind::Empty, Flags });
+	}
+#endif
+
+	FVoxelMaterial Material(ForceInit);
+	if (Voxel.Color > 0)
+	{
+		Material.SetSingleIndex(Voxel.Color - 1);			// MagicaVoxel index start from 1, we are starting from 0
+	}
+	Writer.SetMaterial(X, Y, Material);
+}
 
+void MagicaVox::FMagicaVoxImportWork::Abandon()
+{
+	delete this;
 }
 
-TArray<IMagicaVoxelQueuedWork*> MagicaVox::FMagicaVoxMergeWork::Create(TArray<uint8>& InVoxelData, const FVoxelIntBox& InSceneBounds, const TMap<FVoxelIntBox, TArray<FUintVector4>>& InInstMap)
+TArray<IMagicaVoxelQueuedWork*> MagicaVox::FMagicaVoxMergeWork::Create(FMagicaVoxelArena& InArena, FMagicaVoxSceneData& InVoxelData, const FMagicaVoxUnifiedData& InUnifiedData, const TArray<int32>& InMergeOrder, int32 InMinZ, int32 InMaxZ)
 {
+	// tiles are brick aligned so every brick is written by exactly one work
+	check(InMinZ % TileSize == 0);
+	const FIntVector& SceneSize = InVoxelData.GetSize();
+	const FIntVector& SceneMin = InVoxelData.GetBounds().Min;
+	const FIntVector NumTiles(FMath::DivideAndRoundUp(SceneSize.X, TileSize), FMath::DivideAndRoundUp(SceneSize.Y, TileSize), FMath::DivideAndRoundUp(SceneSize.Z, TileSize));
+	const int32 MinTileZ = InMinZ / TileSize;
+	const int32 MaxTileZ = FMath::Min(FMath::DivideAndRoundUp(FMath::Min(InMaxZ, SceneSize.Z), TileSize), NumTiles.Z);
+	const auto ForEachTile = [&](const int32 InstIndex, auto&& Function)
+	{
+		const FVoxelIntBox Bounds = InUnifiedData.GetInstanceBounds(InstIndex);
+		const FIntVector TileMin = (Bounds.Min - SceneMin) / TileSize;
+		const FIntVector TileMax = (Bounds.Max - SceneMin - FIntVector(1)) / TileSize;
+		for (int32 Z = FMath::Max(TileMin.Z, MinTileZ); Z <= FMath::Min(TileMax.Z, MaxTileZ - 1); Z++)
+		{
+			for (int32 Y = TileMin.Y; Y <= TileMax.Y; Y++)
+			{
+				for (int32 X = TileMin.X; X <= TileMax.X; X++)
+				{
+					Function(X + NumTiles.X * Y + NumTiles.X * NumTiles.Y * Z);
+				}
+			}
+		}
+	};
+	// instances of tile i are TileInstances[TileStarts[i], TileStarts[i + 1]), counted first so every list shares one arena allocation
+	const int32 NumTileIndices = NumTiles.X * NumTiles.Y * NumTiles.Z;
+	TArray<int32> TileStarts;
+	TileStarts.SetNumZeroed(NumTileIndices + 1);
+	for (const int32 InstIndex : InMergeOrder)
+	{
+		ForEachTile(InstIndex, [&](int32 TileIndex) { TileStarts[TileIndex + 1]++; });
+	}
+	for (int32 TileIndex = 0; TileIndex < NumTileIndices; TileIndex++)
+	{
+		TileStarts[TileIndex + 1] += TileStarts[TileIndex];
+	}
+	const TArrayView<int32> TileInstances = InArena.AllocArray<int32>(TileStarts[NumTileIndices]);
+	{
+		TArray<int32> Cursors(TileStarts.GetData(), NumTileIndices);
+		for (const int32 InstIndex : InMergeOrder)
+		{
+			ForEachTile(InstIndex, [&](int32 TileIndex) { TileInstances[Cursors[TileIndex]++] = InstIndex; });
+		}
+	}
+
 	TArray<IMagicaVoxelQueuedWork*> Works;
-	FIntVector SceneSize = InSceneBounds.Size();
-	for (const TPair<FVoxelIntBox, TArray<FUintVector4>>& Inst : InInstMap)
+	for (int32 Z = MinTileZ; Z < MaxTileZ; Z++)
 	{
-		Works.Add(new FMagicaVoxMergeWork(InVoxelData, InSceneBounds, Inst));
+		for (int32 Y = 0; Y < NumTiles.Y; Y++)
+		{
+			for (int32 X = 0; X < NumTiles.X; X++)
+			{
+				const int32 TileIndex = X + NumTiles.X * Y + NumTiles.X * NumTiles.Y * Z;
+				if (TileStarts[TileIndex + 1] > TileStarts[TileIndex])
+				{
+					const FIntVector TileMin = FIntVector(X, Y, Z) * TileSize;
+					const FVoxelIntBox Tile(TileMin, FIntVector(FMath::Min(TileMin.X + TileSize, SceneSize.X), FMath::Min(TileMin.Y + TileSize, SceneSize.Y), FMath::Min(TileMin.Z + TileSize, SceneSize.Z)));
+					const TArrayView<const int32> Instances(TileInstances.GetData() + TileStarts[TileIndex], TileStarts[TileIndex + 1] - TileStarts[TileIndex]);
+					Works.Add(new (InArena) FMagicaVoxMergeWork(InVoxelData, Tile, InUnifiedData, Instances));
+				}
+			}
+		}
 	}
 	return MoveTemp(Works);
 }
 
 void MagicaVox::FMagicaVoxMergeWork::DoThreadedWork()
 {
-	const FVoxelIntBox& Bounds = InstData.Key;
-	FIntVector Origin = Bounds.Min - SceneBounds.Min;
-	FIntVector SceneSize = SceneBounds.Size();
-	for (const FUintVector4& Data : InstData.Value)
+	const FIntVector& SceneMin = VoxelData.GetBounds().Min;
+	for (const int32 InstIndex : Instances)
 	{
-		VoxelData[Origin.X + Data.X + SceneSize.X * (Origin.Y + Data.Y) + SceneSize.X * SceneSize.Y * (Origin.Z + Data.Z)] = Data.W;
+		const FMagicaVoxUnifiedData::FInstance& Inst = UnifiedData.Instances[InstIndex];
+		const FMagicaVoxSpanData& Data = UnifiedData.Payloads[Inst.Payload];
+		// tile clipped to the instance, in instance space
+		const FIntVector Origin = Inst.Origin - SceneMin;
+		const FIntVector Min = FIntVector(FMath::Max(Tile.Min.X - Origin.X, 0), FMath::Max(Tile.Min.Y - Origin.Y, 0), FMath::Max(Tile.Min.Z - Origin.Z, 0));
+		const FIntVector Max = FIntVector(FMath::Min(Tile.Max.X - Origin.X, Data.Size.X), FMath::Min(Tile.Max.Y - Origin.Y, Data.Size.Y), FMath::Min(Tile.Max.Z - Origin.Z, Data.Size.Z));
+		for (int32 Z = Min.Z; Z < Max.Z; Z++)
+		{
+			for (int32 Y = Min.Y; Y < Max.Y; Y++)
+			{
+				const int32 Row = Y + Data.Size.Y * Z;
+				for (int32 SpanIndex = Data.RowOffsets[Row]; SpanIndex < int32(Data.RowOffsets[Row + 1]); SpanIndex++)
+				{
+					const FMagicaVoxSpan& Span = Data.Spans[SpanIndex];
+					const int32 StartX = FMath::Max<int32>(Span.X, Min.X);
+					const int32 EndX = FMath::Min<int32>(Span.X + Span.Length, Max.X);
+					const uint8* Color = Data.Colors.GetData() + Span.ColorOffset + (StartX - Span.X);
+					for (int32 X = StartX; X < EndX; X++)
+					{
+						VoxelData.Set(Origin.X + X, Origin.Y + Y, Origin.Z + Z, *Color++);
+					}
+				}
+			}
+		}
 	}
 
 	delete this;
@@ -656,5 +2401,29 @@ void MagicaVox::FMagicaVoxMergeWork::DoThreadedWork()
 
 void MagicaVox::FMagicaVoxMergeWork::Abandon()
 {
+	delete this;
+}
+
+void MagicaVox::FMagicaVoxUnifyWork::DoThreadedWork()
+{
+	bFailed = !UnifyModelData(Model, Matrix, Arena, Payload);
+
+	delete this;
+}
+
+void MagicaVox::FMagicaVoxUnifyWork::Abandon()
+{
+	delete this;
+}
+
+void MagicaVox::FMagicaVoxLambdaWork::DoThreadedWork()
+{
+	Function();
+
+	delete this;
+}
 
-}
\ No newline at end of file
+void MagicaVox::FMagicaVoxLambdaWork::Abandon()
+{
+	delete this;
+}
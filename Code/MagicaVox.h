@@ -2,23 +2,133 @@
 
 #include "CoreMinimal.h"
 #include "VoxelAssets/VoxelDataAsset.h"
+#include "Importers/MagicaVoxReader.h"
+#include "Importers/MagicaVoxCache.h"
+#include "Importers/MagicaVoxTrace.h"
 
 struct FVoxelDataAssetData;
-struct ogt_vox_scene;
-struct ogt_vox_model;
 struct FVoxelIntBox;
 using namespace UE::Math;
 
+class FMagicaVoxelTaskGroup;
+using FMagicaVoxelTaskGroupPtr = TSharedPtr<FMagicaVoxelTaskGroup, ESPMode::ThreadSafe>;
+using FMagicaVoxelTaskGroupRef = TSharedRef<FMagicaVoxelTaskGroup, ESPMode::ThreadSafe>;
+
+// shared by every group of one import. cancelling abandons their queued works and lets running works bail out early
+class FMagicaVoxelCancelToken
+{
+public:
+	void Cancel() { bCancelled = true; }
+	bool IsCancelled() const { return bCancelled; }
+
+private:
+	FThreadSafeBool bCancelled = false;
+};
+using FMagicaVoxelCancelTokenPtr = TSharedPtr<FMagicaVoxelCancelToken, ESPMode::ThreadSafe>;
+using FMagicaVoxelCancelTokenRef = TSharedRef<FMagicaVoxelCancelToken, ESPMode::ThreadSafe>;
+
+// bump allocator scoped to one import. nothing is freed on its own, Reset releases every block at once
+class FMagicaVoxelArena
+{
+public:
+	explicit FMagicaVoxelArena(int64 InBlockSize = 1024 * 1024) : BlockSize(InBlockSize) {};
+	~FMagicaVoxelArena() { Reset(); }
+
+	FMagicaVoxelArena(const FMagicaVoxelArena&) = delete;
+	FMagicaVoxelArena& operator=(const FMagicaVoxelArena&) = delete;
+
+	// thread safe
+	void* Alloc(int64 Size, int64 Alignment = 16);
+	// uninitialized, only for types that don't need destructing
+	template<typename T>
+	TArrayView<T> AllocArray(int32 Num)
+	{
+		static_assert(TIsTriviallyDestructible<T>::Value, "arena arrays are never destructed");
+		return TArrayView<T>(static_cast<T*>(Alloc(int64(Num) * sizeof(T), alignof(T))), Num);
+	}
+	void Reset();
+	int64 GetAllocatedSize() const;
+
+private:
+	const int64 BlockSize;
+	mutable FCriticalSection Section;
+	TArray<void*> Blocks;
+	uint8* Cursor = nullptr;
+	uint8* End = nullptr;
+	int64 AllocatedSize = 0;
+};
+
 class IMagicaVoxelQueuedWork : public IQueuedWork
 {
 public:
 	// Used for performance reporting and debugging
 	const FName Name;
+	// higher runs first, works of the same priority are interleaved across batches
+	int32 Priority = 0;
+	// set by the pool, notified once the work ran or got abandoned
+	FMagicaVoxelTaskGroupPtr Group;
+	// set by the pool while voxel.ImportTrace is on
+	double QueuedTime = 0.0;
 
 	IMagicaVoxelQueuedWork(FName Name) : Name(Name) {};
 
+	// long works should poll this and return early
+	bool IsCancelled() const;
+
 	IMagicaVoxelQueuedWork(const IMagicaVoxelQueuedWork&) = delete;
 	IMagicaVoxelQueuedWork& operator=(const IMagicaVoxelQueuedWork&) = delete;
+
+	// works come from the heap or from an import arena, delete this is fine for both.
+	// arena works must not keep their arena's owner alive, the arena is released after they are deleted
+	static void* operator new(size_t Size);
+	static void* operator new(size_t Size, FMagicaVoxelArena& Arena);
+	static void operator delete(void* Ptr);
+	static void operator delete(void* Ptr, FMagicaVoxelArena& Arena);
+};
+
+// completion fence for a batch of works. starts open, completes once it is closed and every work added to it is done
+class FMagicaVoxelTaskGroup
+{
+public:
+	~FMagicaVoxelTaskGroup();
+
+	FMagicaVoxelTaskGroup(const FMagicaVoxelTaskGroup&) = delete;
+	FMagicaVoxelTaskGroup& operator=(const FMagicaVoxelTaskGroup&) = delete;
+
+	bool IsDone() const { return bDone; }
+	// ratio of finished works to works added so far
+	float GetProgress() const;
+	bool IsCancelled() const { return CancelToken.IsValid() && CancelToken->IsCancelled(); }
+	// some work was dropped without running, e.g. by a pool shutting down. the group still completes
+	bool IsAbandoned() const { return bAbandoned; }
+	const FMagicaVoxelCancelTokenPtr& GetCancelToken() const { return CancelToken; }
+	// no more works will be added
+	void Close();
+	// blocks without helping the pool, prefer FMagicaVoxelQueuedThreadPool::Wait
+	bool Wait(uint32 WaitTimeMs = MAX_uint32);
+	// runs on the thread finishing the last work, or right away if already done
+	void OnComplete(TFunction<void()>&& Callback);
+
+	static FMagicaVoxelTaskGroupRef Create(const FMagicaVoxelCancelTokenPtr& InCancelToken = nullptr);
+
+private:
+	friend class FMagicaVoxelQueuedThreadPool;
+
+	explicit FMagicaVoxelTaskGroup(const FMagicaVoxelCancelTokenPtr& InCancelToken);
+	void AddPending(int32 Num);
+	void CompleteWork();
+	void CompletePending();
+
+	const FMagicaVoxelCancelTokenPtr CancelToken;
+	// + 1 while open
+	FThreadSafeCounter NumPending;
+	FThreadSafeCounter NumWorks;
+	FThreadSafeCounter NumWorksDone;
+	FThreadSafeBool bDone = false;
+	FThreadSafeBool bAbandoned = false;
+	FEvent* const DoneEvent;
+	FCriticalSection Section;
+	TArray<TFunction<void()>> Callbacks;
 };
 
 class FMagicaVoxelQueuedThreadPool : public TSharedFromThis<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe>
@@ -44,29 +154,60 @@ private:
 	struct FQueuedWorkInfo
 	{
 		IMagicaVoxelQueuedWork* Work;
+		// position of the work in the range its batch pushed to this queue
+		uint32 Round;
+		// threads FirstQueue to FirstQueue + NumQueues - 1, wrapping around, may run the work
+		uint16 FirstQueue;
+		uint16 NumQueues;
 
 		FQueuedWorkInfo() = default;
-		FQueuedWorkInfo(IMagicaVoxelQueuedWork* Work) : Work(Work) {};
+		FQueuedWorkInfo(IMagicaVoxelQueuedWork* Work, uint32 Round, int32 FirstQueue, int32 NumQueues) : Work(Work), Round(Round), FirstQueue(uint16(FirstQueue)), NumQueues(uint16(NumQueues)) {};
+
+		FORCEINLINE bool CanRunOn(int32 ThreadIndex, int32 NumThreads) const
+		{
+			return (ThreadIndex - FirstQueue + NumThreads) % NumThreads < NumQueues;
+		}
 
 		FORCEINLINE uint64 GetPriority() const
 		{
-			return 0;
+			// work priority first, then the earliest round so batches sharing a queue take turns
+			return (uint64(uint32(Work->Priority) ^ 0x80000000u) << 32) | (MAX_uint32 - Round);
 		}
 		FORCEINLINE bool operator<(const FQueuedWorkInfo& Other) const
 		{
-			return GetPriority() < Other.GetPriority();
+			// TArray heaps keep the "smallest" element on top
+			return GetPriority() > Other.GetPriority();
 		}
 	};
 
+	// per thread priority queue. the owner takes the top, thieves the bottom: lowest priority, latest round,
+	// which is the far end of the contiguous range the owner is working through. the owner may run all of its works,
+	// thieves only those whose batch allows them
+	class FWorkQueue
+	{
+	public:
+		void Push(const FQueuedWorkInfo& InWorkInfo);
+		void Push(TArrayView<IMagicaVoxelQueuedWork* const> InWorks, int32 InFirstQueue, int32 InNumQueues);
+		IMagicaVoxelQueuedWork* Pop();
+		IMagicaVoxelQueuedWork* Steal(TFunctionRef<bool(const FQueuedWorkInfo&)> CanSteal);
+		void AbandonAll();
+
+	private:
+		FCriticalSection Section;
+		TArray<FQueuedWorkInfo> Works;
+	};
+
 	class FQueuedThread : public FRunnable
 	{
 	public:
 		const FString ThreadName;
+		const int32 ThreadIndex;
 		FMagicaVoxelQueuedThreadPool* const ThreadPool;
 		/** The event that tells the thread there is work to do. */
 		FEvent* const DoWorkEvent;
+		FWorkQueue Queue;
 
-		FQueuedThread(FMagicaVoxelQueuedThreadPool* Pool, const FString& ThreadName, uint32 StackSize, EThreadPriority ThreadPriority);
+		FQueuedThread(FMagicaVoxelQueuedThreadPool* Pool, const FString& ThreadName, int32 ThreadIndex, uint32 StackSize, EThreadPriority ThreadPriority, uint64 AffinityMask);
 		~FQueuedThread();
 
 		//~ Begin FRunnable Interface
@@ -88,8 +229,15 @@ public:
 	int32 GetNumThreads() const { return AllThreads.Num(); }
 	bool IsWorking();
 
-	void AddQueuedWork(IMagicaVoxelQueuedWork* InQueuedWork);
-	void AddQueuedWorks(const TArray<IMagicaVoxelQueuedWork*>& InQueuedWorks);
+	void AddQueuedWork(IMagicaVoxelQueuedWork* InQueuedWork, const FMagicaVoxelTaskGroupRef& InGroup);
+	// at most InMaxThreads pool threads run the batch, 0 = any of them
+	void AddQueuedWorks(const TArray<IMagicaVoxelQueuedWork*>& InQueuedWorks, const FMagicaVoxelTaskGroupRef& InGroup, int32 InMaxThreads = 0);
+	// queues a batch in its own closed group
+	FMagicaVoxelTaskGroupRef AddQueuedWorks(const TArray<IMagicaVoxelQueuedWork*>& InQueuedWorks, const FMagicaVoxelCancelTokenPtr& InCancelToken = nullptr);
+	// without a timeout, executes the queued works of the group's import on the calling thread until the group is done.
+	// groups of one import are told apart by their cancel token. with a timeout it only sleeps on the group
+	bool Wait(const FMagicaVoxelTaskGroupRef& InGroup, uint32 WaitTimeMs = MAX_uint32);
+	// kills the pool for good, only meant for shutdown. cancel a token to stop a single import
 	void AbandonAllTasks();
 
 	IMagicaVoxelQueuedWork* ReturnToPoolOrGetNextJob(FQueuedThread* InQueuedThread);
@@ -97,65 +245,526 @@ public:
 	//
 	static TSharedRef<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe> Create(int32 NumThreads, uint32 StackSize, EThreadPriority ThreadPriority);
 
+private:
+	// cores thread ThreadIndex may run on, see voxel.ImportPinThreads
+	static uint64 GetThreadAffinityMask(int32 ThreadIndex);
+	// a helping thread, INDEX_NONE, only takes works of InHelpedGroup's import
+	IMagicaVoxelQueuedWork* PopOrSteal(int32 ThreadIndex, const FMagicaVoxelTaskGroup* InHelpedGroup = nullptr);
+	// only the threads a batch pushed to queues FirstQueue to FirstQueue + NumQueues - 1 may run it
+	void WakeUpIdleThreads(int32 FirstQueue, int32 NumQueues);
+	// abandons the work instead if its import got cancelled
+	static void ExecuteWork(IMagicaVoxelQueuedWork* InQueuedWork);
+	static void AbandonWork(IMagicaVoxelQueuedWork* InQueuedWork);
+
 private:
 	TArray<TUniquePtr<FQueuedThread>> AllThreads;
 
 	FCriticalSection Section;
 	TArray<FQueuedThread*> QueuedThreads;
+	// threads in Wait, woken on every push
+	TArray<FEvent*> WaitingHelpers;
 
-	std::priority_queue<FQueuedWorkInfo> QueuedWorks;
+	// bumped after every push and checked under Section before a thread goes idle. a count of queued works would keep threads
+	// spinning on works their batch doesn't allow them to run
+	FThreadSafeCounter NumPushes;
+	FThreadSafeCounter NextQueue;
 
 	FThreadSafeBool TimeToDie = false;
 };
 
 namespace MagicaVox
 {
+	// sparse scene volume, voxels live in bricks allocated on first non-empty write so memory scales with occupied space.
+	// coordinates are local to Bounds.Min, reading an unallocated brick returns 0 (empty).
+	class FMagicaVoxSceneData
+	{
+	public:
+		static constexpr int32 BrickShift = 5;
+		static constexpr int32 BrickSize = 1 << BrickShift;
+		static constexpr int32 BrickMask = BrickSize - 1;
+		static constexpr int32 BrickVoxels = BrickSize * BrickSize * BrickSize;
+		// each brick is followed by one solid bit per voxel, a 32 bit word per row along X
+		static constexpr int32 BrickRows = BrickSize * BrickSize;
+		static_assert(BrickSize == 32, "row masks are one uint32 per brick row");
+		static constexpr int32 BrickBytes = BrickVoxels + BrickRows * sizeof(uint32);
+
+		FMagicaVoxSceneData() = default;
+		~FMagicaVoxSceneData();
+
+		FMagicaVoxSceneData(const FMagicaVoxSceneData&) = delete;
+		FMagicaVoxSceneData& operator=(const FMagicaVoxSceneData&) = delete;
+
+		void Init(const FVoxelIntBox& InBounds);
+		// read only scene over bricks owned by the caller, brick i of InBrickIndices is at InBrickData + i * BrickBytes.
+		// the bricks must outlive the scene data
+		void InitExternal(const FVoxelIntBox& InBounds, TArrayView<const int32> InBrickIndices, const uint8* InBrickData);
+		void Reset();
+		// drops every brick and keeps the bounds, nothing may be reading or writing the scene
+		void ReleaseBricks();
+
+		const FVoxelIntBox& GetBounds() const { return Bounds; }
+		const FIntVector& GetSize() const { return Size; }
+		const FIntVector& GetNumBricks() const { return NumBricks; }
+		int32 GetNumAllocatedBricks() const;
+		int32 GetNumBrickIndices() const { return Bricks.Num(); }
+		// null for bricks that were never written
+		const uint8* GetBrick(int32 BrickIndex) const { return Bricks[BrickIndex]; }
+		static int64 CountBrickIndices(const FVoxelIntBox& InBounds);
+
+		FORCEINLINE bool IsValidPosition(int32 X, int32 Y, int32 Z) const
+		{
+			return X >= 0 && Y >= 0 && Z >= 0 && X < Size.X && Y < Size.Y && Z < Size.Z;
+		}
+		FORCEINLINE int32 GetBrickIndex(int32 X, int32 Y, int32 Z) const
+		{
+			return (X >> BrickShift) + NumBricks.X * ((Y >> BrickShift) + NumBricks.Y * (Z >> BrickShift));
+		}
+		FORCEINLINE static int32 GetIndexInBrick(int32 X, int32 Y, int32 Z)
+		{
+			return (X & BrickMask) + ((Y & BrickMask) << BrickShift) + ((Z & BrickMask) << (2 * BrickShift));
+		}
+		FORCEINLINE uint8 Get(int32 X, int32 Y, int32 Z) const
+		{
+			checkSlow(IsValidPosition(X, Y, Z));
+			const uint8* Brick = Bricks[GetBrickIndex(X, Y, Z)];
+			return Brick ? Brick[GetIndexInBrick(X, Y, Z)] : 0;
+		}
+		// solid bits of the brick row starting at a brick aligned X. 0 outside the scene and for unallocated bricks
+		FORCEINLINE uint32 GetRowBits(int32 X, int32 Y, int32 Z) const
+		{
+			if (!IsValidPosition(X, Y, Z))
+			{
+				return 0;
+			}
+			const uint8* Brick = Bricks[GetBrickIndex(X, Y, Z)];
+			return Brick ? GetRowMasks(Brick)[(Y & BrickMask) + ((Z & BrickMask) << BrickShift)] : 0;
+		}
+
+		// allocates the brick if needed, writing 0 never allocates. threads may write at the same time as long as they never share a brick
+		void Set(int32 X, int32 Y, int32 Z, uint8 Value);
+
+	private:
+		uint8* AddBrick(int32 BrickIndex);
+		FORCEINLINE static uint32* GetRowMasks(uint8* Brick) { return reinterpret_cast<uint32*>(Brick + BrickVoxels); }
+		FORCEINLINE static const uint32* GetRowMasks(const uint8* Brick) { return reinterpret_cast<const uint32*>(Brick + BrickVoxels); }
+
+		FVoxelIntBox Bounds;
+		FIntVector Size = FIntVector::ZeroValue;
+		FIntVector NumBricks = FIntVector::ZeroValue;
+		TArray<uint8*> Bricks;
+		// bricks are never freed one by one
+		FMagicaVoxelArena BrickArena{ 64 * BrickBytes };
+		bool bExternal = false;
+	};
+
+	// run of non-empty voxels along X, in instance space
+	struct FMagicaVoxSpan
+	{
+		uint16 X;
+		uint16 Y;
+		uint16 Z;
+		uint16 Length;
+		uint32 ColorOffset;
+	};
+
+	// unified instance, spans are sorted by Z, Y then X and index into Colors. empty voxels are not stored.
+	// the arrays live in the arena passed to UnifyModelData
+	struct FMagicaVoxSpanData
+	{
+		FIntVector Size = FIntVector::ZeroValue;
+		// spans of row Y + Size.Y * Z are [RowOffsets[Row], RowOffsets[Row + 1])
+		TArrayView<uint32> RowOffsets;
+		TArrayView<FMagicaVoxSpan> Spans;
+		TArrayView<uint8> Colors;
+	};
+
+	// unify output. instances of the same model and rotation share one payload and only keep their position
+	struct FMagicaVoxUnifiedData
+	{
+		struct FInstance
+		{
+			FIntVector Origin;
+			int32 Payload;
+		};
+		struct FPayloadSource
+		{
+			int32 ModelIndex;
+			// first instance using the payload, its transform is the one unified
+			int32 Instance;
+		};
+
+		TArray<FInstance> Instances;
+		TArray<FPayloadSource> Sources;
+		TArray<FMagicaVoxSpanData> Payloads;
+		TArray<bool> Failed;
+
+		FVoxelIntBox GetInstanceBounds(int32 Instance) const
+		{
+			const FInstance& Inst = Instances[Instance];
+			return FVoxelIntBox(Inst.Origin, Inst.Origin + Payloads[Inst.Payload].Size);
+		}
+		void Reset()
+		{
+			Instances.Empty();
+			Sources.Empty();
+			Payloads.Empty();
+			Failed.Empty();
+		}
+	};
+
+	// solidity of every point border resolution probes: hexagon centers and the neighbour offsets around them.
+	// points are addressed by period tile and site, one 2D bit grid per Z. outside the scene reads empty
+	class FMagicaVoxHexOccupancy
+	{
+	public:
+		void Init(const FMagicaVoxSceneData& InSceneData, const FVoxelDataAssetImportSettings_MagicaVox& InSetting);
+		void Reset();
+		// one work per few layers of [InMinZ, InMaxZ), layers are word aligned so works never share a word
+		TArray<IMagicaVoxelQueuedWork*> CreateWorks(FMagicaVoxelArena& InArena, int32 InMinZ = 0, int32 InMaxZ = MAX_int32);
+		TArrayView<const uint32> GetBits() const { return Bits; }
+		// instead of the works, InBits must come from an Init with the same scene size and hexagon settings
+		bool SetBits(TArrayView<const uint32> InBits);
+		// what the bits depend on besides the scene
+		static uint64 HashSetting(const FVoxelDataAssetImportSettings_MagicaVox& InSetting);
+
+		FORCEINLINE bool IsSolid(int32 X, int32 Y, int32 Z) const
+		{
+			if (X < 0 || Y < 0 || Z < 0 || X >= SceneSize.X || Y >= SceneSize.Y || Z >= SceneSize.Z)
+			{
+				return false;
+			}
+			const int32 TileX = X / Period.X;
+			const int32 TileY = Y / Period.Y;
+			const int32 Site = SiteIndices[(X - TileX * Period.X) + Period.X * (Y - TileY * Period.Y)];
+			if (Site == INDEX_NONE)
+			{
+				return SceneData->Get(X, Y, Z) != 0;
+			}
+			const int32 Bit = (TileX + NumTiles.X * TileY) * Sites.Num() + Site;
+			return (Bits[int64(Z) * WordsPerLayer + (Bit >> 5)] >> (Bit & 31)) & 1;
+		}
+
+	private:
+		void BuildLayer(int32 Z);
+
+		const FMagicaVoxSceneData* SceneData = nullptr;
+		FIntVector SceneSize = FIntVector::ZeroValue;
+		FIntPoint Period = FIntPoint::ZeroValue;
+		FIntPoint NumTiles = FIntPoint::ZeroValue;
+		// position of each site inside a period, and the reverse lookup
+		TArray<FIntPoint> Sites;
+		TArray<int32> SiteIndices;
+		int32 WordsPerLayer = 0;
+		TArray<uint32> Bits;
+	};
+
+	enum class EMagicaVoxImportPhase : uint8
+	{
+		Read,
+		Decode,
+		Unify,
+		Merge,
+		Value,
+		Done,
+	};
+
+	// called on the game thread. Asset is the task's owned asset, null when Launch got none. ImportToAssetAsync always passes one
+	using FMagicaVoxImportCallback = TFunction<void(bool bSuccess, const TSharedPtr<FVoxelDataAssetData>& Asset, const FString& Error)>;
+
+	// one import running on the import pool, each phase is queued once the previous one completes
+	class FMagicaVoxImportTask : public TSharedFromThis<FMagicaVoxImportTask, ESPMode::ThreadSafe>
+	{
+	public:
+		FMagicaVoxImportTask(const FMagicaVoxImportTask&) = delete;
+		FMagicaVoxImportTask& operator=(const FMagicaVoxImportTask&) = delete;
+
+		EMagicaVoxImportPhase GetPhase() const { return Phase; }
+		// 0..1 within the current phase
+		float GetPhaseProgress() const;
+		// wall time spent in a phase so far, streaming imports add up every slab
+		double GetPhaseSeconds(EMagicaVoxImportPhase InPhase) const;
+		bool IsDone() const { return DoneGroup->IsDone(); }
+		bool IsSuccess() const { return IsDone() && bSuccess; }
+		FString GetError() const;
+		void Cancel() { CancelToken->Cancel(); }
+		bool IsCancelled() const { return CancelToken->IsCancelled(); }
+		// helps with this import's works when waiting without a timeout, returns false on timeout
+		bool Wait(uint32 WaitTimeMs = MAX_uint32);
+
+		// InAsset must outlive the task, InOwnedAsset is what the callback receives and may be null
+		static TSharedRef<FMagicaVoxImportTask, ESPMode::ThreadSafe> Launch(const FString& InFilename, FVoxelDataAssetData& InAsset, const TSharedPtr<FVoxelDataAssetData>& InOwnedAsset, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, FMagicaVoxImportCallback&& InOnComplete);
+
+	private:
+		FMagicaVoxImportTask(const TSharedRef<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe>& InPool, const FString& InFilename, FVoxelDataAssetData& InAsset, const TSharedPtr<FVoxelDataAssetData>& InOwnedAsset, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, FMagicaVoxImportCallback&& InOnComplete);
+
+		// works run on at most MaxThreads pool threads so small scenes don't wake the whole pool
+		void RunStage(EMagicaVoxImportPhase InPhase, TArray<IMagicaVoxelQueuedWork*>&& InWorks, void (FMagicaVoxImportTask::*InNext)());
+		// Section must be held
+		void SetPhase(EMagicaVoxImportPhase InPhase);
+		void Read();
+		void Decode();
+		// one work per model with payloads in ModelPayloads
+		TArray<IMagicaVoxelQueuedWork*> CreateDecodeWorks();
+		void DecodeModel(int32 ModelIndex);
+		// streaming imports run decode to value once per slab
+		void StartSlab();
+		void NextSlab();
+		bool IsStreaming() const { return SlabLayers > 0; }
+		int32 GetSlabMaxZ() const { return IsStreaming() ? FMath::Min(SlabMinZ + SlabLayers, SceneData.GetSize().Z) : SceneData.GetSize().Z; }
+		void Merge();
+		void Value();
+		void WriteValues();
+		// unset when the whole asset has to be written
+		TOptional<TBitArray<>> GetChangedBricks() const;
+		void SaveCache();
+		// content hash of Asset, one work per chunk of its values and materials
+		TArray<IMagicaVoxelQueuedWork*> CreateAssetHashWorks();
+		uint64 GetAssetHash() const;
+		// records what was just written so the next import of the file can tell whether the asset still holds it
+		void StampAsset();
+		void SaveAssetStamp();
+		void Succeed();
+		void Finish(const FString& InError);
+
+		// kept alive by the task so the pool can't be released under a running import
+		const TSharedRef<FMagicaVoxelQueuedThreadPool, ESPMode::ThreadSafe> Pool;
+		const FString Filename;
+		FVoxelDataAssetData& Asset;
+		const TSharedPtr<FVoxelDataAssetData> OwnedAsset;
+		const FVoxelDataAssetImportSettings_MagicaVox Setting;
+		FMagicaVoxImportCallback OnComplete;
+		const FMagicaVoxelCancelTokenRef CancelToken;
+		// closed once the import finished, failed or got cancelled
+		const FMagicaVoxelTaskGroupRef DoneGroup;
+		// track of this import in voxel.ImportTrace
+		const int32 TraceId;
+		// pool threads a stage may keep busy, lowered once the scene is indexed
+		int32 MaxThreads = 0;
+
+		// stages run one after another, only the progress getters race with them
+		FString ReadError;
+		FMagicaVoxScene Scene;
+		// loaded by the read stage when the file didn't change since the last import, SceneData then points into it
+		FMagicaVoxCacheKey CacheKey;
+		FMagicaVoxSceneCache Cache;
+		// the loaded cache's occupancy didn't fit the settings and was rebuilt. its replacement is written next to it and moved in by Finish
+		bool bResaveCache = false;
+		FString PendingCachePath;
+		// brick hashes of this import and of the one that wrote the cache, the value pass only rewrites bricks that changed
+		TArray<uint64> BrickHashes;
+		TArray<uint64> PreviousBrickHashes;
+		FVoxelIntBox PreviousBounds;
+		uint64 PreviousSettingsHash = 0;
+		// FMagicaVoxImportWork::HashSetting, the cache key only holds what the occupancy depends on
+		uint64 ValueSettingsHash = 0;
+		// of the last import of this file into whatever asset, and the hash of the asset as it is before this import writes
+		FMagicaVoxAssetStamp PreviousStamp;
+		bool bHasPreviousStamp = false;
+		TArray<uint64> AssetChunkHashes;
+		TOptional<uint64> PreviousAssetHash;
+		// false when an incremental import found no dirty brick, the asset is then hashed only once
+		bool bAssetWritten = true;
+		TArray<TArray<int32>> ModelPayloads;
+		FThreadSafeCounter NumModelsToDecode;
+		// works and unify payloads, released once the merge is done and again when finishing
+		FMagicaVoxelArena Arena;
+		FMagicaVoxUnifiedData UnifiedData;
+		FMagicaVoxSceneData SceneData;
+		FMagicaVoxHexOccupancy Occupancy;
+		// scenes over voxel.ImportSlabBudget are merged and written SlabLayers at a time, only the current slab's bricks and payloads are in memory
+		int32 SlabLayers = 0;
+		int32 SlabMinZ = 0;
+
+		mutable FCriticalSection Section;
+		TAtomic<EMagicaVoxImportPhase> Phase{ EMagicaVoxImportPhase::Read };
+		double PhaseStartTime = 0.0;
+		double PhaseSeconds[int32(EMagicaVoxImportPhase::Done)] = {};
+		FMagicaVoxelTaskGroupPtr StageGroup;
+		FString Error;
+		bool bSuccess = false;
+	};
+
+	// blocking import with a cancellable progress dialog, game thread only
 	bool ImportToAsset(const FString& Filename, FVoxelDataAssetData& Asset, const FVoxelDataAssetImportSettings_MagicaVox& InSetting);
-	bool MergeSceneData(const ogt_vox_scene* InScene, TPair<FVoxelIntBox, TArray<uint8>>& OutData);
-	bool UnifyModelData(const ogt_vox_model* InModel, const FMatrix44f& InMatrix, TPair<FVoxelIntBox, TArray<FUintVector4>>& OutData);
+	// returns right away, OnComplete receives the imported asset on the game thread
+	TSharedRef<FMagicaVoxImportTask, ESPMode::ThreadSafe> ImportToAssetAsync(const FString& Filename, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, FMagicaVoxImportCallback&& OnComplete);
+	// drops the import pool if no import holds it, the next one creates a pool sized for itself. game thread only
+	bool ReleaseImportPool();
+	// instance bounds in scene space and the matrix mapping model indices to indices inside those bounds
+	bool GetUnifiedTransform(const FIntVector& InModelSize, const FMatrix44f& InMatrix, FVoxelIntBox& OutBounds, FMatrix44f& OutIndexMatrix);
+	// OutData points into InArena
+	bool UnifyModelData(const FMagicaVoxModel& InModel, const FMatrix44f& InMatrix, FMagicaVoxelArena& InArena, FMagicaVoxSpanData& OutData);
+
+	// buffers one X/Y tile of a layer in magica coordinates and flushes it as one run of the asset's value and material arrays per
+	// magica X, magica Y being the asset's contiguous axis. only cells inside the tile can be written, and all of them have to be
+	// written before Flush
+	class FMagicaVoxTileWriter
+	{
+	public:
+		static constexpr int32 TileSize = 16;
+
+		explicit FMagicaVoxTileWriter(FVoxelDataAssetData& InAssetData) : AssetData(InAssetData) {};
+
+		void Begin(int32 InMinX, int32 InMinY, int32 InMaxX, int32 InMaxY, int32 InZ);
+		void Flush();
+
+		void SetValue(int32 X, int32 Y, const FVoxelValue& Value);
+		void SetMaterial(int32 X, int32 Y, const FVoxelMaterial& Material);
+
+	private:
+		FORCEINLINE bool IsInTile(int32 X, int32 Y) const { return X >= MinX && Y >= MinY && X < MaxX && Y < MaxY; }
+		// transposed, consecutive Y are adjacent like in the asset
+		FORCEINLINE static int32 GetIndex(int32 LocalX, int32 LocalY) { return LocalY + TileSize * LocalX; }
+
+		FVoxelDataAssetData& AssetData;
+		int32 MinX = 0;
+		int32 MinY = 0;
+		int32 MaxX = 0;
+		int32 MaxY = 0;
+		int32 Z = 0;
+		FVoxelValue Values[TileSize * TileSize];
+		FVoxelMaterial Materials[TileSize * TileSize];
+	};
 
 	class FMagicaVoxImportWork : public IMagicaVoxelQueuedWork
 	{
 	public:
-		FMagicaVoxImportWork(FVoxelDataAssetData& InAssetData, const TArray<uint8>& InMagicaData, const FVoxelIntBox& InBounds, const FIntVector& InSceneSize, const FVoxelDataAssetImportSettings_MagicaVox& InSetting)
-			: IMagicaVoxelQueuedWork("FMagicaVoxImportWork"), AssetData(InAssetData), MagicaData(InMagicaData), Bounds(InBounds), SceneSize(InSceneSize), Setting(InSetting) {};
+		// hexagon classification of one X/Y period, the same for every Z
+		struct FHexEntry
+		{
+			// chosen center relative to the voxel, diagonal one when the voxel isn't on the straight one's border
+			int32 CenterX;
+			int32 CenterY;
+			// IsInbound against that center
+			uint8 Inbound;
+			// border clock position before the neighbour centers are checked
+			uint8 ClockPos;
+		};
+		struct FHexTable
+		{
+			FIntPoint Period;
+			TArray<FHexEntry> Entries;
+
+			FORCEINLINE const FHexEntry& Get(int32 X, int32 Y) const { return Entries[X % Period.X + Period.X * (Y % Period.Y)]; }
+		};
+		// what a solid voxel writes: Inside to itself, Outside to the empty neighbour at X + Shift when Shift isn't 0
+		struct FClassifiedVoxel
+		{
+			FVoxelValue Inside;
+			FVoxelValue Outside;
+			uint8 Color = 0;
+			int8 Shift = 0;
+		};
+
+		FMagicaVoxImportWork(FVoxelDataAssetData& InAssetData, const FMagicaVoxSceneData& InMagicaData, const FMagicaVoxHexOccupancy& InOccupancy, const FVoxelIntBox& InBounds, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, const TSharedRef<const FHexTable, ESPMode::ThreadSafe>& InHexTable, int32 InCaptureZ, int32 InCaptureImport)
+			: IMagicaVoxelQueuedWork("FMagicaVoxImportWork"), AssetData(InAssetData), MagicaData(InMagicaData), Occupancy(InOccupancy), Bounds(InBounds), SceneSize(InMagicaData.GetSize()), Setting(InSetting), HexTable(InHexTable), CaptureZ(InCaptureZ), CaptureImport(InCaptureImport) {};
 
 		//~ Begin IQueuedWork Interface
 		virtual void DoThreadedWork() override;
 		virtual void Abandon() override;
 		//~ End IQueuedWork Interface
 		
-		static TArray<IMagicaVoxelQueuedWork*> Create(FVoxelDataAssetData& InAssetData, const TPair<FVoxelIntBox, TArray<uint8>>& InSceneData, uint32 InNumThreads, const FVoxelDataAssetImportSettings_MagicaVox& InSetting);
+		// InOccupancy has to be built from InSceneData before the works run
+		// with InDirtyBricks the asset keeps its size and content, only the set scene bricks are rewritten.
+		// InImport tags the voxel.LogImport records of these works
+		static TArray<IMagicaVoxelQueuedWork*> Create(FMagicaVoxelArena& InArena, FVoxelDataAssetData& InAssetData, const FMagicaVoxSceneData& InSceneData, const FMagicaVoxHexOccupancy& InOccupancy, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, const TBitArray<>* InDirtyBricks = nullptr, int32 InImport = 0);
+		// bricks whose values can change when the scene bricks set in InChangedBricks changed: classification reads
+		// hexagon centers and their neighbours, up to about two hexagons away on the same layer
+		static TBitArray<> GetDirtyBricks(const FMagicaVoxSceneData& InSceneData, const FVoxelDataAssetImportSettings_MagicaVox& InSetting, const TBitArray<>& InChangedBricks);
+		// every setting the value pass reads: the hexagon size and the values by height. materials only come from palette indices
+		static uint64 HashSetting(const FVoxelDataAssetImportSettings_MagicaVox& InSetting);
 
 	private:
 		// shared code with @hexagon shader, check if they are synced while debugging.
-		FVector GetCenter(const FVector& v, bool bDiagonal) const;
-		int32 IsInbound(const FVector& c, const FVector& v) const;
-		int32 GetBorderClockPos(FVector& c, const FVector& v) const;
+		static FVector GetCenter(const FVoxelDataAssetImportSettings_MagicaVox& Setting, const FVector& v, bool bDiagonal);
+		static int32 IsInbound(const FVoxelDataAssetImportSettings_MagicaVox& Setting, const FVector& c, const FVector& v);
+		static int32 GetRawClockPos(const FVoxelDataAssetImportSettings_MagicaVox& Setting, const FVector& c, const FVector& v);
+		int32 GetBorderClockPos(FVector& c, int32 cp) const;
+		FORCEINLINE bool ProbeOccupancy(int32 X, int32 Y, int32 Z) const
+		{
+			NumProbes++;
+			return Occupancy.IsSolid(X, Y, Z);
+		}
 		// shared code with @hexagon shader, check if they are synced while debugging.
-		
+
+		static TSharedRef<const FHexTable, ESPMode::ThreadSafe> CreateHexTable(const FVoxelDataAssetImportSettings_MagicaVox& InSetting);
+		// only reads the scene and the occupancy, so halo cells of a neighbour tile classify the same in every work
+		FClassifiedVoxel ClassifyVoxel(int32 X, int32 Y, int32 Z, uint8 Color, bool bCapture) const;
+		// final value of a cell from its own classification and the ones at X - 1 and X + 1
+		void ResolveVoxel(FMagicaVoxTileWriter& Writer, int32 X, int32 Y, int32 Z, const FClassifiedVoxel& Left, const FClassifiedVoxel& Voxel, const FClassifiedVoxel& Right, bool bCapture) const;
+
 		FVoxelDataAssetData& AssetData;
-		const TArray<uint8>& MagicaData;
+		const FMagicaVoxSceneData& MagicaData;
+		const FMagicaVoxHexOccupancy& Occupancy;
 		const FVoxelIntBox Bounds;
 		const FIntVector SceneSize;
 		const FVoxelDataAssetImportSettings_MagicaVox Setting;
+		const TSharedRef<const FHexTable, ESPMode::ThreadSafe> HexTable;
+		// layer recorded for voxel.LogImport, INDEX_NONE when it is off
+		const int32 CaptureZ;
+		const int32 CaptureImport;
+		// voxel.ImportTrace counters, added up once the work is done
+		mutable int64 NumClassified = 0;
+		mutable int64 NumBorderVoxels = 0;
+		mutable int64 NumProbes = 0;
 	};
 
+	// merges every instance overlapping one brick aligned tile, in merge order. tiles never share bricks so the result doesn't depend on scheduling
 	class FMagicaVoxMergeWork : public IMagicaVoxelQueuedWork
 	{
 	public:
-		FMagicaVoxMergeWork(TArray<uint8>& InVoxelData, const FVoxelIntBox& InSceneBounds, const TPair<FVoxelIntBox, TArray<FUintVector4>>& InInstData) : IMagicaVoxelQueuedWork("FMagicaVoxMergeWork"), VoxelData(InVoxelData), InstData(InInstData), SceneBounds(InSceneBounds) {};
+		static constexpr int32 TileSize = FMagicaVoxSceneData::BrickSize * 2;
+
+		FMagicaVoxMergeWork(FMagicaVoxSceneData& InVoxelData, const FVoxelIntBox& InTile, const FMagicaVoxUnifiedData& InUnifiedData, TArrayView<const int32> InInstances)
+			: IMagicaVoxelQueuedWork("FMagicaVoxMergeWork"), VoxelData(InVoxelData), Tile(InTile), UnifiedData(InUnifiedData), Instances(InInstances) {};
 
 		//~ Begin IQueuedWork Interface
 		virtual void DoThreadedWork() override;
 		virtual void Abandon() override;
 		//~ End IQueuedWork Interface
 
-		static TArray<IMagicaVoxelQueuedWork*> Create(TArray<uint8>& InVoxelData, const FVoxelIntBox& InSceneBounds, const TMap<FVoxelIntBox, TArray<FUintVector4>>& InInstMap);
+		// works and their instance lists are allocated in InArena. only tiles in the layers [InMinZ, InMaxZ) are merged, InMinZ has to be tile aligned
+		static TArray<IMagicaVoxelQueuedWork*> Create(FMagicaVoxelArena& InArena, FMagicaVoxSceneData& InVoxelData, const FMagicaVoxUnifiedData& InUnifiedData, const TArray<int32>& InMergeOrder, int32 InMinZ = 0, int32 InMaxZ = MAX_int32);
+
+	private:
+		FMagicaVoxSceneData& VoxelData;
+		const FVoxelIntBox Tile;
+		const FMagicaVoxUnifiedData& UnifiedData;
+		const TArrayView<const int32> Instances;
+	};
+
+	class FMagicaVoxUnifyWork : public IMagicaVoxelQueuedWork
+	{
+	public:
+		FMagicaVoxUnifyWork(const FMagicaVoxModel& InModel, const FMatrix44f& InMatrix, FMagicaVoxelArena& InArena, FMagicaVoxSpanData& OutPayload, bool& bOutFailed)
+			: IMagicaVoxelQueuedWork("FMagicaVoxUnifyWork"), Model(InModel), Matrix(InMatrix), Arena(InArena), Payload(OutPayload), bFailed(bOutFailed) {};
+
+		//~ Begin IQueuedWork Interface
+		virtual void DoThreadedWork() override;
+		virtual void Abandon() override;
+		//~ End IQueuedWork Interface
+
+	private:
+		const FMagicaVoxModel& Model;
+		const FMatrix44f Matrix;
+		FMagicaVoxelArena& Arena;
+		FMagicaVoxSpanData& Payload;
+		bool& bFailed;
+	};
+
+	// runs a single function on the pool, for stages that don't split
+	class FMagicaVoxLambdaWork : public IMagicaVoxelQueuedWork
+	{
+	public:
+		FMagicaVoxLambdaWork(FName InName, TFunction<void()>&& InFunction)
+			: IMagicaVoxelQueuedWork(InName), Function(MoveTemp(InFunction)) {};
+
+		//~ Begin IQueuedWork Interface
+		virtual void DoThreadedWork() override;
+		virtual void Abandon() override;
+		//~ End IQueuedWork Interface
 
 	private:
-		TArray<uint8>& VoxelData;
-		const TPair<FVoxelIntBox, TArray<FUintVector4>>& InstData;
-		const FVoxelIntBox SceneBounds;
+		TFunction<void()> Function;
 	};
-}
\ No newline at end of file
+}
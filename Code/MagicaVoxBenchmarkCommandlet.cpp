@@ -0,0 +1,477 @@
+#include "Importers/MagicaVoxBenchmarkCommandlet.h"
+#include "Importers/MagicaVox.h"
+
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace MagicaVoxBenchmark
+{
+	using namespace MagicaVox;
+
+	enum class EScene : uint8
+	{
+		// thousands of 16^3 instances sharing 4 models
+		SmallInstances,
+		// a few distinct 256^3 models, the largest MagicaVoxel allows
+		LargeInstances,
+		// 64^3 blobs in every rotation, overlapping their neighbours
+		RotatedOverlapping,
+		// hexagon columns, only the top voxels of each column
+		SparseTerrain,
+		// hexagon columns filled down to the ground
+		DenseTerrain,
+		Num,
+	};
+
+	static const TCHAR* GetSceneName(EScene Scene)
+	{
+		static const TCHAR* Names[] = { TEXT("SmallInstances"), TEXT("LargeInstances"), TEXT("RotatedOverlapping"), TEXT("SparseTerrain"), TEXT("DenseTerrain") };
+		return Names[int32(Scene)];
+	}
+
+	static uint32 Hash(int32 X, int32 Y, int32 Z)
+	{
+		uint32 H = uint32(X) * 73856093u ^ uint32(Y) * 19349663u ^ uint32(Z) * 83492791u;
+		H ^= H >> 16;
+		H *= 0x7feb352du;
+		H ^= H >> 15;
+		H *= 0x846ca68bu;
+		H ^= H >> 16;
+		return H;
+	}
+
+	static uint8 GetColor(int32 X, int32 Y, int32 Z)
+	{
+		return uint8(1 + Hash(X, Y, Z) % 255);
+	}
+
+	// one of the 48 rotations an nTRN _r can hold: bits 0-1 and 2-3 are the columns of row 0 and 1, bits 4-6 the row signs
+	static uint8 GetRotation(int32 Index)
+	{
+		static constexpr int32 Columns[6][2] = { { 0, 1 }, { 0, 2 }, { 1, 0 }, { 1, 2 }, { 2, 0 }, { 2, 1 } };
+		const int32 Order = (Index / 8) % 6;
+		return uint8(Columns[Order][0] | Columns[Order][1] << 2 | (Index % 8) << 4);
+	}
+	static constexpr uint8 IdentityRotation = 1 << 2;
+
+	static constexpr uint32 MakeId(char A, char B, char C, char D)
+	{
+		return uint32(uint8(A)) | uint32(uint8(B)) << 8 | uint32(uint8(C)) << 16 | uint32(uint8(D)) << 24;
+	}
+
+	// little endian .vox writer, only the chunks the reader indexes
+	struct FWriter
+	{
+		TArray<uint8>& Bytes;
+
+		void Int(int32 Value)
+		{
+			Bytes.Append(reinterpret_cast<const uint8*>(&Value), sizeof(int32));
+		}
+		void String(const FString& Value)
+		{
+			const FTCHARToUTF8 Utf8(*Value);
+			Int(Utf8.Length());
+			Bytes.Append(reinterpret_cast<const uint8*>(Utf8.Get()), Utf8.Length());
+		}
+		// content size is patched by EndChunk, children are never nested
+		int32 BeginChunk(uint32 Id)
+		{
+			Int(Id);
+			Int(0);
+			Int(0);
+			return Bytes.Num();
+		}
+		void EndChunk(int32 Start)
+		{
+			const int32 Size = Bytes.Num() - Start;
+			FMemory::Memcpy(Bytes.GetData() + Start - 8, &Size, sizeof(int32));
+		}
+	};
+
+	struct FScene
+	{
+		struct FModel
+		{
+			FIntVector Size;
+			// x y z and color index per voxel
+			TArray<uint8> Voxels;
+		};
+		struct FInstance
+		{
+			int32 Model;
+			FIntVector Translation;
+			uint8 Rotation;
+		};
+
+		TArray<FModel> Models;
+		TArray<FInstance> Instances;
+
+		// InColor returns 0 for empty voxels
+		int32 AddModel(const FIntVector& Size, TFunctionRef<uint8(int32 X, int32 Y, int32 Z)> InColor)
+		{
+			FModel& Model = Models.AddDefaulted_GetRef();
+			Model.Size = Size;
+			for (int32 Z = 0; Z < Size.Z; Z++)
+			{
+				for (int32 Y = 0; Y < Size.Y; Y++)
+				{
+					for (int32 X = 0; X < Size.X; X++)
+					{
+						if (const uint8 Color = InColor(X, Y, Z))
+						{
+							const uint8 Voxel[] = { uint8(X), uint8(Y), uint8(Z), Color };
+							Model.Voxels.Append(Voxel, 4);
+						}
+					}
+				}
+			}
+			return Models.Num() - 1;
+		}
+
+		// MagicaVoxel translates the model's center
+		void AddInstance(int32 Model, const FIntVector& Min, uint8 Rotation = IdentityRotation)
+		{
+			Instances.Add({ Model, Min + Models[Model].Size / 2, Rotation });
+		}
+
+		// voxels of every instance, what unify and merge go through
+		int64 GetNumVoxels() const
+		{
+			int64 Num = 0;
+			for (const FInstance& Instance : Instances)
+			{
+				Num += Models[Instance.Model].Voxels.Num() / 4;
+			}
+			return Num;
+		}
+
+		TArray<uint8> Write() const
+		{
+			TArray<uint8> Bytes;
+			FWriter Writer{ Bytes };
+			Writer.Int(MakeId('V', 'O', 'X', ' '));
+			Writer.Int(150);
+			Writer.Int(MakeId('M', 'A', 'I', 'N'));
+			Writer.Int(0);
+			Writer.Int(0);
+			const int32 MainStart = Bytes.Num();
+			for (const FModel& Model : Models)
+			{
+				const int32 Size = Writer.BeginChunk(MakeId('S', 'I', 'Z', 'E'));
+				Writer.Int(Model.Size.X);
+				Writer.Int(Model.Size.Y);
+				Writer.Int(Model.Size.Z);
+				Writer.EndChunk(Size);
+				const int32 Voxels = Writer.BeginChunk(MakeId('X', 'Y', 'Z', 'I'));
+				Writer.Int(Model.Voxels.Num() / 4);
+				Bytes.Append(Model.Voxels);
+				Writer.EndChunk(Voxels);
+			}
+			// root transform, one group, then a transform and a shape per instance
+			{
+				const int32 Root = Writer.BeginChunk(MakeId('n', 'T', 'R', 'N'));
+				Writer.Int(0);
+				Writer.Int(0);
+				Writer.Int(1);
+				Writer.Int(-1);
+				Writer.Int(-1);
+				Writer.Int(1);
+				Writer.Int(0);
+				Writer.EndChunk(Root);
+				const int32 Group = Writer.BeginChunk(MakeId('n', 'G', 'R', 'P'));
+				Writer.Int(1);
+				Writer.Int(0);
+				Writer.Int(Instances.Num());
+				for (int32 Index = 0; Index < Instances.Num(); Index++)
+				{
+					Writer.Int(2 + Index * 2);
+				}
+				Writer.EndChunk(Group);
+			}
+			for (int32 Index = 0; Index < Instances.Num(); Index++)
+			{
+				const FInstance& Instance = Instances[Index];
+				const int32 Transform = Writer.BeginChunk(MakeId('n', 'T', 'R', 'N'));
+				Writer.Int(2 + Index * 2);
+				Writer.Int(0);
+				Writer.Int(3 + Index * 2);
+				Writer.Int(-1);
+				Writer.Int(0);
+				Writer.Int(1);
+				Writer.Int(2);
+				Writer.String(TEXT("_r"));
+				Writer.String(FString::FromInt(Instance.Rotation));
+				Writer.String(TEXT("_t"));
+				Writer.String(FString::Printf(TEXT("%d %d %d"), Instance.Translation.X, Instance.Translation.Y, Instance.Translation.Z));
+				Writer.EndChunk(Transform);
+				const int32 Shape = Writer.BeginChunk(MakeId('n', 'S', 'H', 'P'));
+				Writer.Int(3 + Index * 2);
+				Writer.Int(0);
+				Writer.Int(1);
+				Writer.Int(Instance.Model);
+				Writer.Int(0);
+				Writer.EndChunk(Shape);
+			}
+			const int32 ChildrenSize = Bytes.Num() - MainStart;
+			FMemory::Memcpy(Bytes.GetData() + MainStart - 4, &ChildrenSize, sizeof(int32));
+			return Bytes;
+		}
+	};
+
+	// Scale grows the instance grid, not the models
+	static FScene MakeScene(EScene Scene, int32 Scale)
+	{
+		FScene Result;
+		switch (Scene)
+		{
+		case EScene::SmallInstances:
+		{
+			for (int32 Model = 0; Model < 4; Model++)
+			{
+				const float Radius = 6.f + Model * 0.5f;
+				Result.AddModel(FIntVector(16), [&](int32 X, int32 Y, int32 Z)
+				{
+					return FVector3f(X - 7.5f, Y - 7.5f, Z - 7.5f).SizeSquared() <= Radius * Radius ? GetColor(X, Y, Z) : 0;
+				});
+			}
+			const int32 Side = 32 * Scale;
+			for (int32 Y = 0; Y < Side; Y++)
+			{
+				for (int32 X = 0; X < Side; X++)
+				{
+					Result.AddInstance(Hash(X, Y, 0) % 4, FIntVector(X * 16, Y * 16, 0));
+				}
+			}
+			break;
+		}
+		case EScene::LargeInstances:
+		{
+			for (int32 Y = 0; Y < 2; Y++)
+			{
+				for (int32 X = 0; X < 2 * Scale; X++)
+				{
+					const int32 Model = Result.AddModel(FIntVector(256), [&](int32 VoxelX, int32 VoxelY, int32 VoxelZ)
+					{
+						return VoxelZ < 96 + int32(Hash(VoxelX / 8, VoxelY / 8, X + Y * 1024) % 64) ? GetColor(VoxelX, VoxelY, VoxelZ) : 0;
+					});
+					Result.AddInstance(Model, FIntVector(X * 256, Y * 256, 0));
+				}
+			}
+			break;
+		}
+		case EScene::RotatedOverlapping:
+		{
+			for (int32 Model = 0; Model < 8; Model++)
+			{
+				// stretched so rotations actually move voxels around, with holes
+				Result.AddModel(FIntVector(64, 48, 32), [&](int32 X, int32 Y, int32 Z)
+				{
+					const FVector3f Offset((X - 31.5f) / 32.f, (Y - 23.5f) / 24.f, (Z - 15.5f) / 16.f);
+					return Offset.SizeSquared() <= 1.f && Hash(X, Y, Z + Model * 64) % 8 != 0 ? GetColor(X, Y, Z) : 0;
+				});
+			}
+			const int32 Side = 16 * Scale;
+			for (int32 Y = 0; Y < 16; Y++)
+			{
+				for (int32 X = 0; X < Side; X++)
+				{
+					const uint32 InstanceHash = Hash(X, Y, 1);
+					Result.AddInstance(InstanceHash % 8, FIntVector(X * 40, Y * 40, (InstanceHash >> 8) % 32), GetRotation((InstanceHash >> 16) % 48));
+				}
+			}
+			break;
+		}
+		case EScene::SparseTerrain:
+		case EScene::DenseTerrain:
+		{
+			// offset rows of hexagon sized cells, one height per cell
+			static constexpr int32 HalfWidth = 12;
+			static constexpr int32 RowHeight = 21;
+			const bool bDense = Scene == EScene::DenseTerrain;
+			const int32 Side = 2 * Scale;
+			for (int32 TileY = 0; TileY < Side; TileY++)
+			{
+				for (int32 TileX = 0; TileX < Side; TileX++)
+				{
+					const int32 Model = Result.AddModel(FIntVector(256, 256, 64), [&](int32 X, int32 Y, int32 Z)
+					{
+						const int32 Row = (TileY * 256 + Y) / RowHeight;
+						const int32 Column = (TileX * 256 + X + (Row & 1) * HalfWidth) / (2 * HalfWidth);
+						const int32 Height = 8 + Hash(Column, Row, 2) % 48;
+						return Z < Height && (bDense || Z >= Height - 2) ? GetColor(X, Y, Z) : 0;
+					});
+					Result.AddInstance(Model, FIntVector(TileX * 256, TileY * 256, 0));
+				}
+			}
+			break;
+		}
+		default:
+			check(false);
+		}
+		return Result;
+	}
+
+	struct FRun
+	{
+		bool bSuccess = false;
+		double TotalSeconds = 0.0;
+		double PhaseSeconds[int32(EMagicaVoxImportPhase::Done)] = {};
+		int64 PeakBytes = 0;
+		int64 NumCells = 0;
+	};
+
+	static FRun RunImport(const FString& Path, const FVoxelDataAssetImportSettings_MagicaVox& Setting, int32 NumThreads)
+	{
+		IConsoleManager::Get().FindConsoleVariable(TEXT("voxel.ImportThreads"))->Set(NumThreads, ECVF_SetByCode);
+		// the previous task's last completion may still hold its pool for a moment
+		while (!ReleaseImportPool())
+		{
+			FPlatformProcess::Sleep(0.001f);
+		}
+		FRun Run;
+		FVoxelDataAssetData Asset;
+		const uint64 BaseMemory = FPlatformMemory::GetStats().UsedPhysical;
+		uint64 PeakMemory = BaseMemory;
+		const double StartTime = FPlatformTime::Seconds();
+		const TSharedRef<FMagicaVoxImportTask, ESPMode::ThreadSafe> Task = FMagicaVoxImportTask::Launch(Path, Asset, nullptr, Setting, nullptr);
+		// sleep instead of Wait, a helping game thread would count as one more worker.
+		// memory is sampled, the process peak can't be reset between runs
+		while (!Task->IsDone())
+		{
+			PeakMemory = FMath::Max(PeakMemory, FPlatformMemory::GetStats().UsedPhysical);
+			FPlatformProcess::Sleep(0.005f);
+		}
+		Run.TotalSeconds = FPlatformTime::Seconds() - StartTime;
+		Run.bSuccess = Task->IsSuccess();
+		if (!Run.bSuccess)
+		{
+			UE_LOG(LogTemp, Error, TEXT("import of %s failed: %s"), *Path, *Task->GetError());
+		}
+		for (int32 Phase = 0; Phase < int32(EMagicaVoxImportPhase::Done); Phase++)
+		{
+			Run.PhaseSeconds[Phase] = Task->GetPhaseSeconds(EMagicaVoxImportPhase(Phase));
+		}
+		Run.PeakBytes = int64(PeakMemory - BaseMemory);
+		const FIntVector Size = Asset.GetSize();
+		Run.NumCells = int64(Size.X) * Size.Y * Size.Z;
+		return Run;
+	}
+}
+
+UMagicaVoxBenchmarkCommandlet::UMagicaVoxBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UMagicaVoxBenchmarkCommandlet::Main(const FString& Params)
+{
+	using namespace MagicaVoxBenchmark;
+
+	FString SceneFilter;
+	FString CsvPath;
+	int32 Scale = 1;
+	int32 MaxThreads = FMath::Max(FPlatformMisc::NumberOfCores() - 1, 1);
+	int32 NumRuns = 1;
+	int32 HalfWidth = 12;
+	FParse::Value(*Params, TEXT("Scene="), SceneFilter);
+	FParse::Value(*Params, TEXT("Csv="), CsvPath);
+	FParse::Value(*Params, TEXT("Scale="), Scale);
+	FParse::Value(*Params, TEXT("Threads="), MaxThreads);
+	FParse::Value(*Params, TEXT("Runs="), NumRuns);
+	FParse::Value(*Params, TEXT("HalfWidth="), HalfWidth);
+	Scale = FMath::Max(Scale, 1);
+	MaxThreads = FMath::Max(MaxThreads, 1);
+	NumRuns = FMath::Max(NumRuns, 1);
+
+	FVoxelDataAssetImportSettings_MagicaVox Setting;
+	Setting.HalfWidth = HalfWidth;
+
+	// every run imports from scratch
+	IConsoleVariable* CacheVariable = IConsoleManager::Get().FindConsoleVariable(TEXT("voxel.ImportCache"));
+	IConsoleVariable* ThreadsVariable = IConsoleManager::Get().FindConsoleVariable(TEXT("voxel.ImportThreads"));
+	const int32 PreviousCache = CacheVariable->GetInt();
+	const int32 PreviousThreads = ThreadsVariable->GetInt();
+	CacheVariable->Set(0, ECVF_SetByCode);
+
+	// 1, 2, 4 ... and the maximum
+	TArray<int32> ThreadCounts;
+	for (int32 NumThreads = 1; ; NumThreads *= 2)
+	{
+		ThreadCounts.Add(FMath::Min(NumThreads, MaxThreads));
+		if (NumThreads >= MaxThreads)
+		{
+			break;
+		}
+	}
+
+	static const TCHAR* PhaseNames[] = { TEXT("Read"), TEXT("Decode"), TEXT("Unify"), TEXT("Merge"), TEXT("Value") };
+	static_assert(UE_ARRAY_COUNT(PhaseNames) == int32(EMagicaVoxImportPhase::Done), "one name per phase");
+	TArray<FString> CsvLines;
+	CsvLines.Add(TEXT("scene,threads,total_seconds,peak_mb,phase,seconds,voxels_per_second"));
+	const FString Directory = FPaths::ProjectSavedDir() / TEXT("MagicaVoxBenchmark");
+	bool bSuccess = true;
+	for (int32 SceneIndex = 0; SceneIndex < int32(EScene::Num); SceneIndex++)
+	{
+		const EScene Scene = EScene(SceneIndex);
+		if (!SceneFilter.IsEmpty() && SceneFilter != GetSceneName(Scene))
+		{
+			continue;
+		}
+		const FString Path = Directory / FString::Printf(TEXT("%s_%d.vox"), GetSceneName(Scene), Scale);
+		int64 NumVoxels;
+		{
+			const FScene Generated = MakeScene(Scene, Scale);
+			NumVoxels = Generated.GetNumVoxels();
+			if (!FFileHelper::SaveArrayToFile(Generated.Write(), *Path))
+			{
+				UE_LOG(LogTemp, Error, TEXT("failed to write %s"), *Path);
+				bSuccess = false;
+				continue;
+			}
+			UE_LOG(LogTemp, Display, TEXT("%s: %d models, %d instances, %lld voxels, %.1f MB"), GetSceneName(Scene), Generated.Models.Num(), Generated.Instances.Num(), NumVoxels, IFileManager::Get().FileSize(*Path) / (1024.0 * 1024.0));
+		}
+
+		for (const int32 NumThreads : ThreadCounts)
+		{
+			// best of the runs, the file stays in the page cache after the first one
+			FRun Best;
+			for (int32 RunIndex = 0; RunIndex < NumRuns; RunIndex++)
+			{
+				const FRun Run = RunImport(Path, Setting, NumThreads);
+				bSuccess &= Run.bSuccess;
+				if (RunIndex == 0 || Run.TotalSeconds < Best.TotalSeconds)
+				{
+					Best = Run;
+				}
+			}
+			const double PeakMB = Best.PeakBytes / (1024.0 * 1024.0);
+			UE_LOG(LogTemp, Display, TEXT("%s threads %d: %.3fs, peak %.1f MB"), GetSceneName(Scene), NumThreads, Best.TotalSeconds, PeakMB);
+			for (int32 Phase = 0; Phase < int32(EMagicaVoxImportPhase::Done); Phase++)
+			{
+				// the value pass goes through every asset cell, the earlier phases through the instance voxels
+				const int64 PhaseVoxels = EMagicaVoxImportPhase(Phase) == EMagicaVoxImportPhase::Value ? Best.NumCells : NumVoxels;
+				const double Seconds = Best.PhaseSeconds[Phase];
+				const double VoxelsPerSecond = Seconds > 0.0 ? PhaseVoxels / Seconds : 0.0;
+				UE_LOG(LogTemp, Display, TEXT("    %-6s %8.3fs %10.2f Mvox/s"), PhaseNames[Phase], Seconds, VoxelsPerSecond / 1e6);
+				CsvLines.Add(FString::Printf(TEXT("%s,%d,%.6f,%.1f,%s,%.6f,%.0f"), GetSceneName(Scene), NumThreads, Best.TotalSeconds, PeakMB, PhaseNames[Phase], Seconds, VoxelsPerSecond));
+			}
+		}
+		IFileManager::Get().Delete(*Path);
+	}
+
+	CacheVariable->Set(PreviousCache, ECVF_SetByCode);
+	ThreadsVariable->Set(PreviousThreads, ECVF_SetByCode);
+	ReleaseImportPool();
+	if (!CsvPath.IsEmpty() && !FFileHelper::SaveStringArrayToFile(CsvLines, *CsvPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("failed to write %s"), *CsvPath);
+		bSuccess = false;
+	}
+	return bSuccess ? 0 : 1;
+}
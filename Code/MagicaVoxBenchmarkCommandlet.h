@@ -0,0 +1,20 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "MagicaVoxBenchmarkCommandlet.generated.h"
+
+// headless import benchmark over generated .vox scenes, imported into a throwaway asset at 1..N pool threads.
+// UnrealEditor-Cmd <Project> -run=MagicaVoxBenchmark [-Scene=<name>] [-Scale=1] [-Threads=N] [-Runs=1] [-HalfWidth=12] [-Csv=<path>]
+UCLASS()
+class UMagicaVoxBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UMagicaVoxBenchmarkCommandlet();
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+};
@@ -0,0 +1,316 @@
+#include "Importers/MagicaVoxCache.h"
+#include "Importers/MagicaVox.h"
+
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Hash/CityHash.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+// bump when the layout below or FMagicaVoxSceneData's bricks change
+static constexpr uint32 MagicaVoxCacheMagic = 0x4358564D;		// MVXC
+static constexpr uint32 MagicaVoxCacheVersion = 2;
+// bricks are cache line aligned in the file, the mapping itself is page aligned
+static constexpr int64 MagicaVoxCacheAlignment = 64;
+
+// file layout: header, brick index table, bricks, occupancy words, brick hashes
+struct MagicaVox::FMagicaVoxSceneCache::FHeader
+{
+	uint32 Magic;
+	uint32 Version;
+	uint64 FileHash;
+	int64 FileSize;
+	int32 MergeOrder;
+	int32 NumBricks;
+	uint64 SettingsHash;
+	FIntVector BoundsMin;
+	FIntVector BoundsMax;
+	int64 BrickTableOffset;
+	int64 BrickDataOffset;
+	int64 OccupancyOffset;
+	int64 NumOccupancyWords;
+	// one per brick index, allocated or not
+	int64 BrickHashOffset;
+	int64 NumBrickHashes;
+	int64 TotalSize;
+};
+
+uint64 MagicaVox::FMagicaVoxCacheKey::HashFile(const uint8* Data, int64 Size)
+{
+	// CityHash takes 32 bit lengths, chain it for huge files
+	static constexpr int64 ChunkSize = 1 << 30;
+	uint64 Hash = 0;
+	for (int64 Offset = 0; Offset < Size; Offset += ChunkSize)
+	{
+		Hash = CityHash64WithSeed(reinterpret_cast<const char*>(Data + Offset), uint32(FMath::Min(ChunkSize, Size - Offset)), Hash);
+	}
+	return Hash;
+}
+
+FString MagicaVox::FMagicaVoxAssetStamp::GetStampPath(const FString& CachePath)
+{
+	return FPaths::ChangeExtension(CachePath, TEXT("mvxstamp"));
+}
+
+uint64 MagicaVox::FMagicaVoxAssetStamp::HashScene(const FVoxelIntBox& Bounds, TArrayView<const uint64> BrickHashes)
+{
+	const FIntVector Corners[] = { Bounds.Min, Bounds.Max };
+	const uint64 BoundsHash = CityHash64(reinterpret_cast<const char*>(Corners), sizeof(Corners));
+	return FMagicaVoxCacheKey::HashFile(reinterpret_cast<const uint8*>(BrickHashes.GetData()), BrickHashes.NumBytes()) ^ BoundsHash;
+}
+
+bool MagicaVox::FMagicaVoxAssetStamp::Load(const FString& Path)
+{
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *Path, FILEREAD_Silent) || Bytes.Num() != sizeof(FMagicaVoxAssetStamp) + sizeof(uint64))
+	{
+		return false;
+	}
+	// a checksum instead of a header, the file is tiny and rewritten by every import
+	uint64 Check;
+	FMemory::Memcpy(&Check, Bytes.GetData() + sizeof(FMagicaVoxAssetStamp), sizeof(uint64));
+	if (Check != CityHash64WithSeed(reinterpret_cast<const char*>(Bytes.GetData()), sizeof(FMagicaVoxAssetStamp), MagicaVoxCacheVersion))
+	{
+		return false;
+	}
+	FMemory::Memcpy(this, Bytes.GetData(), sizeof(FMagicaVoxAssetStamp));
+	return true;
+}
+
+bool MagicaVox::FMagicaVoxAssetStamp::Save(const FString& Path) const
+{
+	TArray<uint8> Bytes;
+	Bytes.Append(reinterpret_cast<const uint8*>(this), sizeof(FMagicaVoxAssetStamp));
+	const uint64 Check = CityHash64WithSeed(reinterpret_cast<const char*>(this), sizeof(FMagicaVoxAssetStamp), MagicaVoxCacheVersion);
+	Bytes.Append(reinterpret_cast<const uint8*>(&Check), sizeof(uint64));
+	// moved into place like the cache, concurrent imports of the file each publish a whole stamp
+	const FString TempPath = FString::Printf(TEXT("%s.%s.tmp"), *Path, *FGuid::NewGuid().ToString(EGuidFormats::Digits));
+	if (!FFileHelper::SaveArrayToFile(Bytes, *TempPath) || !IFileManager::Get().Move(*Path, *TempPath, true, true))
+	{
+		IFileManager::Get().Delete(*TempPath);
+		return false;
+	}
+	return true;
+}
+
+MagicaVox::FMagicaVoxSceneCache::~FMagicaVoxSceneCache()
+{
+	Reset();
+}
+
+FString MagicaVox::FMagicaVoxSceneCache::GetCachePath(const FString& SourceFilename)
+{
+	const FString FullPath = FPaths::ConvertRelativePathToFull(SourceFilename);
+	const uint64 PathHash = CityHash64(reinterpret_cast<const char*>(*FullPath), FullPath.Len() * sizeof(TCHAR));
+	return FPaths::ProjectSavedDir() / TEXT("MagicaVoxCache") / FString::Printf(TEXT("%s_%016llx.mvxcache"), *FPaths::GetBaseFilename(SourceFilename), PathHash);
+}
+
+bool MagicaVox::FMagicaVoxSceneCache::Load(const FString& Path, const FMagicaVoxCacheKey& Key)
+{
+	Reset();
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if (!PlatformFile.FileExists(*Path))
+	{
+		return false;
+	}
+	MappedFile.Reset(PlatformFile.OpenMapped(*Path));
+	if (!MappedFile.IsValid() || MappedFile->GetFileSize() < int64(sizeof(FHeader)))
+	{
+		Reset();
+		return false;
+	}
+	MappedRegion.Reset(MappedFile->MapRegion(0, MappedFile->GetFileSize()));
+	if (!MappedRegion.IsValid())
+	{
+		Reset();
+		return false;
+	}
+
+	const FHeader* Mapped = reinterpret_cast<const FHeader*>(MappedRegion->GetMappedPtr());
+	const int64 NumBrickIndices = FMagicaVoxSceneData::CountBrickIndices(FVoxelIntBox(Mapped->BoundsMin, Mapped->BoundsMax));
+	const bool bValid = Mapped->Magic == MagicaVoxCacheMagic
+		&& Mapped->Version == MagicaVoxCacheVersion
+		&& Mapped->FileHash == Key.FileHash
+		&& Mapped->FileSize == Key.FileSize
+		&& Mapped->MergeOrder == Key.MergeOrder
+		&& Mapped->TotalSize == MappedRegion->GetMappedSize()
+		&& Mapped->NumBricks >= 0 && Mapped->NumBricks <= NumBrickIndices
+		&& Mapped->BrickTableOffset + Mapped->NumBricks * int64(sizeof(int32)) <= Mapped->BrickDataOffset
+		&& Mapped->BrickDataOffset % MagicaVoxCacheAlignment == 0
+		&& Mapped->BrickDataOffset + Mapped->NumBricks * int64(FMagicaVoxSceneData::BrickBytes) <= Mapped->OccupancyOffset
+		&& Mapped->OccupancyOffset + Mapped->NumOccupancyWords * int64(sizeof(uint32)) <= Mapped->BrickHashOffset
+		&& Mapped->BrickHashOffset % sizeof(uint64) == 0
+		&& Mapped->NumBrickHashes == NumBrickIndices
+		&& Mapped->BrickHashOffset + Mapped->NumBrickHashes * int64(sizeof(uint64)) <= Mapped->TotalSize;
+	if (!bValid)
+	{
+		Reset();
+		return false;
+	}
+	const int32* BrickIndices = reinterpret_cast<const int32*>(MappedRegion->GetMappedPtr() + Mapped->BrickTableOffset);
+	for (int32 Index = 0; Index < Mapped->NumBricks; Index++)
+	{
+		if (BrickIndices[Index] < 0 || BrickIndices[Index] >= NumBrickIndices)
+		{
+			Reset();
+			return false;
+		}
+	}
+	Header = Mapped;
+	bSettingsMatch = Header->SettingsHash == Key.SettingsHash;
+	return true;
+}
+
+void MagicaVox::FMagicaVoxSceneCache::GetSceneData(FMagicaVoxSceneData& OutData) const
+{
+	check(IsLoaded());
+	const uint8* Data = MappedRegion->GetMappedPtr();
+	OutData.InitExternal(FVoxelIntBox(Header->BoundsMin, Header->BoundsMax), TArrayView<const int32>(reinterpret_cast<const int32*>(Data + Header->BrickTableOffset), Header->NumBricks), Data + Header->BrickDataOffset);
+}
+
+TArrayView<const uint32> MagicaVox::FMagicaVoxSceneCache::GetOccupancyBits() const
+{
+	if (!IsLoaded() || !bSettingsMatch)
+	{
+		return {};
+	}
+	return TArrayView<const uint32>(reinterpret_cast<const uint32*>(MappedRegion->GetMappedPtr() + Header->OccupancyOffset), Header->NumOccupancyWords);
+}
+
+TArrayView<const uint64> MagicaVox::FMagicaVoxSceneCache::GetBrickHashes() const
+{
+	if (!IsLoaded())
+	{
+		return {};
+	}
+	return TArrayView<const uint64>(reinterpret_cast<const uint64*>(MappedRegion->GetMappedPtr() + Header->BrickHashOffset), Header->NumBrickHashes);
+}
+
+uint64 MagicaVox::FMagicaVoxSceneCache::GetSettingsHash() const
+{
+	return IsLoaded() ? Header->SettingsHash : 0;
+}
+
+void MagicaVox::FMagicaVoxSceneCache::Reset()
+{
+	Header = nullptr;
+	bSettingsMatch = false;
+	MappedRegion.Reset();
+	MappedFile.Reset();
+}
+
+bool MagicaVox::FMagicaVoxSceneCache::Save(const FString& Path, const FMagicaVoxCacheKey& Key, const FMagicaVoxSceneData& SceneData, TArrayView<const uint32> OccupancyBits, TArrayView<const uint64> BrickHashes)
+{
+	const FString TempPath = SaveTemp(Path, Key, SceneData, OccupancyBits, BrickHashes);
+	return !TempPath.IsEmpty() && Replace(Path, TempPath);
+}
+
+FString MagicaVox::FMagicaVoxSceneCache::SaveTemp(const FString& Path, const FMagicaVoxCacheKey& Key, const FMagicaVoxSceneData& SceneData, TArrayView<const uint32> OccupancyBits, TArrayView<const uint64> BrickHashes)
+{
+	check(BrickHashes.Num() == SceneData.GetNumBrickIndices());
+	TArray<int32> BrickIndices;
+	for (int32 BrickIndex = 0; BrickIndex < SceneData.GetNumBrickIndices(); BrickIndex++)
+	{
+		if (SceneData.GetBrick(BrickIndex))
+		{
+			BrickIndices.Add(BrickIndex);
+		}
+	}
+
+	FHeader Header;
+	FMemory::Memzero(Header);
+	Header.Magic = MagicaVoxCacheMagic;
+	Header.Version = MagicaVoxCacheVersion;
+	Header.FileHash = Key.FileHash;
+	Header.FileSize = Key.FileSize;
+	Header.MergeOrder = Key.MergeOrder;
+	Header.NumBricks = BrickIndices.Num();
+	Header.SettingsHash = Key.SettingsHash;
+	Header.BoundsMin = SceneData.GetBounds().Min;
+	Header.BoundsMax = SceneData.GetBounds().Max;
+	Header.BrickTableOffset = sizeof(FHeader);
+	Header.BrickDataOffset = Align(Header.BrickTableOffset + BrickIndices.NumBytes(), MagicaVoxCacheAlignment);
+	Header.OccupancyOffset = Header.BrickDataOffset + int64(BrickIndices.Num()) * FMagicaVoxSceneData::BrickBytes;
+	Header.NumOccupancyWords = OccupancyBits.Num();
+	Header.BrickHashOffset = Align(Header.OccupancyOffset + OccupancyBits.NumBytes(), sizeof(uint64));
+	Header.NumBrickHashes = BrickHashes.Num();
+	Header.TotalSize = Header.BrickHashOffset + BrickHashes.NumBytes();
+
+	// unique per save, imports of the same file can run at the same time and must not share a half written file
+	const FString TempPath = FString::Printf(TEXT("%s.%s.tmp"), *Path, *FGuid::NewGuid().ToString(EGuidFormats::Digits));
+	{
+		const TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath));
+		if (!Writer.IsValid())
+		{
+			return {};
+		}
+		uint8 Padding[MagicaVoxCacheAlignment] = {};
+		Writer->Serialize(&Header, sizeof(FHeader));
+		Writer->Serialize(BrickIndices.GetData(), BrickIndices.NumBytes());
+		Writer->Serialize(Padding, Header.BrickDataOffset - Header.BrickTableOffset - BrickIndices.NumBytes());
+		for (const int32 BrickIndex : BrickIndices)
+		{
+			Writer->Serialize(const_cast<uint8*>(SceneData.GetBrick(BrickIndex)), FMagicaVoxSceneData::BrickBytes);
+		}
+		Writer->Serialize(const_cast<uint32*>(OccupancyBits.GetData()), OccupancyBits.NumBytes());
+		Writer->Serialize(Padding, Header.BrickHashOffset - Header.OccupancyOffset - OccupancyBits.NumBytes());
+		Writer->Serialize(const_cast<uint64*>(BrickHashes.GetData()), BrickHashes.NumBytes());
+		if (!Writer->Close() || Writer->IsError())
+		{
+			IFileManager::Get().Delete(*TempPath);
+			return {};
+		}
+	}
+	return TempPath;
+}
+
+bool MagicaVox::FMagicaVoxSceneCache::Replace(const FString& Path, const FString& TempPath)
+{
+	if (!IFileManager::Get().Move(*Path, *TempPath, true, true))
+	{
+		// another import's cache is mapped or being moved in, it's as good as ours
+		IFileManager::Get().Delete(*TempPath);
+		return false;
+	}
+	return true;
+}
+
+bool MagicaVox::FMagicaVoxSceneCache::LoadBrickHashes(const FString& Path, FVoxelIntBox& OutBounds, uint64& OutSettingsHash, TArray<uint64>& OutHashes)
+{
+	const TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*Path));
+	if (!Reader.IsValid() || Reader->TotalSize() < int64(sizeof(FHeader)))
+	{
+		return false;
+	}
+	FHeader Header;
+	Reader->Serialize(&Header, sizeof(FHeader));
+	const FVoxelIntBox Bounds(Header.BoundsMin, Header.BoundsMax);
+	if (Reader->IsError()
+		|| Header.Magic != MagicaVoxCacheMagic
+		|| Header.Version != MagicaVoxCacheVersion
+		|| Header.TotalSize != Reader->TotalSize()
+		|| Header.NumBrickHashes != FMagicaVoxSceneData::CountBrickIndices(Bounds)
+		|| Header.BrickHashOffset < int64(sizeof(FHeader))
+		|| Header.BrickHashOffset + Header.NumBrickHashes * int64(sizeof(uint64)) > Header.TotalSize)
+	{
+		return false;
+	}
+	OutHashes.SetNumUninitialized(Header.NumBrickHashes);
+	Reader->Seek(Header.BrickHashOffset);
+	Reader->Serialize(OutHashes.GetData(), OutHashes.NumBytes());
+	if (Reader->IsError())
+	{
+		OutHashes.Reset();
+		return false;
+	}
+	OutBounds = Bounds;
+	OutSettingsHash = Header.SettingsHash;
+	return true;
+}
+
+uint64 MagicaVox::FMagicaVoxSceneCache::HashBrick(const uint8* Brick)
+{
+	// the row masks are derived from the voxels, a written brick never hashes to 0
+	return Brick ? CityHash64(reinterpret_cast<const char*>(Brick), FMagicaVoxSceneData::BrickVoxels) | 1 : 0;
+}
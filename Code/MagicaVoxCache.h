@@ -0,0 +1,86 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+struct FVoxelIntBox;
+
+namespace MagicaVox
+{
+	class FMagicaVoxSceneData;
+
+	// what a cache file was built from. the merged scene only depends on the file and the merge order,
+	// the hexagon occupancy also depends on the hexagon size
+	struct FMagicaVoxCacheKey
+	{
+		uint64 FileHash = 0;
+		int64 FileSize = 0;
+		int32 MergeOrder = 0;
+		uint64 SettingsHash = 0;
+
+		static uint64 HashFile(const uint8* Data, int64 Size);
+	};
+
+	// what the last import of a file wrote into its asset, saved next to the file's cache. the cache is keyed by the source only,
+	// so the content hash is what proves an asset still holds that import before only its changed bricks are rewritten
+	struct FMagicaVoxAssetStamp
+	{
+		uint64 SceneHash = 0;
+		// every setting the value pass reads, not only the hexagon size the cache key holds
+		uint64 SettingsHash = 0;
+		uint64 AssetHash = 0;
+
+		static FString GetStampPath(const FString& CachePath);
+		// bounds and brick hashes of a merged scene
+		static uint64 HashScene(const FVoxelIntBox& Bounds, TArrayView<const uint64> BrickHashes);
+
+		bool Load(const FString& Path);
+		bool Save(const FString& Path) const;
+	};
+
+	// merged scene of one .vox file, its hexagon occupancy bits and one hash per brick, one file per source under Saved/MagicaVoxCache.
+	// a loaded cache is memory mapped, scene bricks point straight into the mapping
+	class FMagicaVoxSceneCache
+	{
+	public:
+		FMagicaVoxSceneCache() = default;
+		~FMagicaVoxSceneCache();
+
+		FMagicaVoxSceneCache(const FMagicaVoxSceneCache&) = delete;
+		FMagicaVoxSceneCache& operator=(const FMagicaVoxSceneCache&) = delete;
+
+		static FString GetCachePath(const FString& SourceFilename);
+
+		// false when missing, stale or corrupt
+		bool Load(const FString& Path, const FMagicaVoxCacheKey& Key);
+		bool IsLoaded() const { return Header != nullptr; }
+		// the scene data reads the mapped bricks, the cache must stay loaded while it is used
+		void GetSceneData(FMagicaVoxSceneData& OutData) const;
+		// empty when the cache was built with other hexagon settings
+		TArrayView<const uint32> GetOccupancyBits() const;
+		// one per brick index, see HashBrick
+		TArrayView<const uint64> GetBrickHashes() const;
+		uint64 GetSettingsHash() const;
+		void Reset();
+
+		// writes a temporary file first so a failed save never leaves a broken cache
+		static bool Save(const FString& Path, const FMagicaVoxCacheKey& Key, const FMagicaVoxSceneData& SceneData, TArrayView<const uint32> OccupancyBits, TArrayView<const uint64> BrickHashes);
+		// Save in two steps, for a scene still reading the mapped cache it replaces: the temporary file is written first and
+		// moved over the cache once it's unmapped. SaveTemp returns the temporary path, empty on failure
+		static FString SaveTemp(const FString& Path, const FMagicaVoxCacheKey& Key, const FMagicaVoxSceneData& SceneData, TArrayView<const uint32> OccupancyBits, TArrayView<const uint64> BrickHashes);
+		static bool Replace(const FString& Path, const FString& TempPath);
+		// brick hashes of whatever import wrote the cache, even for another version of the file. read without mapping so the file can be replaced afterwards
+		static bool LoadBrickHashes(const FString& Path, FVoxelIntBox& OutBounds, uint64& OutSettingsHash, TArray<uint64>& OutHashes);
+		// 0 for bricks that were never written
+		static uint64 HashBrick(const uint8* Brick);
+
+	private:
+		struct FHeader;
+
+		TUniquePtr<IMappedFileHandle> MappedFile;
+		TUniquePtr<IMappedFileRegion> MappedRegion;
+		const FHeader* Header = nullptr;
+		bool bSettingsMatch = false;
+	};
+}
@@ -0,0 +1,367 @@
+#include "Importers/MagicaVoxReader.h"
+
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+
+namespace MagicaVoxRiff
+{
+	static constexpr uint32 MakeId(char A, char B, char C, char D)
+	{
+		return uint32(uint8(A)) | uint32(uint8(B)) << 8 | uint32(uint8(C)) << 16 | uint32(uint8(D)) << 24;
+	}
+
+	static constexpr uint32 Id_VOX = MakeId('V', 'O', 'X', ' ');
+	static constexpr uint32 Id_MAIN = MakeId('M', 'A', 'I', 'N');
+	static constexpr uint32 Id_SIZE = MakeId('S', 'I', 'Z', 'E');
+	static constexpr uint32 Id_XYZI = MakeId('X', 'Y', 'Z', 'I');
+	static constexpr uint32 Id_nTRN = MakeId('n', 'T', 'R', 'N');
+	static constexpr uint32 Id_nGRP = MakeId('n', 'G', 'R', 'P');
+	static constexpr uint32 Id_nSHP = MakeId('n', 'S', 'H', 'P');
+	// voxel coordinates are single bytes, a larger model couldn't address its own cells
+	static constexpr int32 MaxModelSize = 256;
+
+	// bounds checked little endian cursor over one chunk
+	struct FCursor
+	{
+		const uint8* Ptr;
+		const uint8* End;
+
+		int64 Remaining() const { return End - Ptr; }
+
+		bool Skip(int64 Num)
+		{
+			if (Num < 0 || Remaining() < Num)
+			{
+				return false;
+			}
+			Ptr += Num;
+			return true;
+		}
+
+		bool Read(uint32& Out)
+		{
+			if (Remaining() < 4)
+			{
+				return false;
+			}
+			FMemory::Memcpy(&Out, Ptr, 4);
+			Ptr += 4;
+			return true;
+		}
+
+		bool Read(int32& Out)
+		{
+			return Read(reinterpret_cast<uint32&>(Out));
+		}
+
+		bool Read(FString& Out)
+		{
+			int32 Len;
+			if (!Read(Len) || Len < 0 || Remaining() < Len)
+			{
+				return false;
+			}
+			Out = FString(Len, reinterpret_cast<const ANSICHAR*>(Ptr));
+			Ptr += Len;
+			return true;
+		}
+
+		bool Read(TMap<FString, FString>& Out)
+		{
+			int32 Num;
+			if (!Read(Num) || Num < 0)
+			{
+				return false;
+			}
+			for (int32 Index = 0; Index < Num; Index++)
+			{
+				FString Key;
+				FString Value;
+				if (!Read(Key) || !Read(Value))
+				{
+					return false;
+				}
+				Out.Add(MoveTemp(Key), MoveTemp(Value));
+			}
+			return true;
+		}
+	};
+
+	// _r packs the rotation rows: bits 0-1 and 2-3 are the non-zero column of row 0 and 1, bits 4-6 the row signs.
+	// UE transforms row vectors, so like ogt_vox the stored rows become the matrix columns
+	static FMatrix44f MakeTransform(const TMap<FString, FString>& InFrame)
+	{
+		FMatrix44f Transform = FMatrix44f::Identity;
+		if (const FString* Rotation = InFrame.Find(TEXT("_r")))
+		{
+			const uint32 Bits = FCString::Atoi(**Rotation);
+			const int32 Columns[3] = { int32(Bits & 3), int32((Bits >> 2) & 3), 3 - int32(Bits & 3) - int32((Bits >> 2) & 3) };
+			if (Columns[0] < 3 && Columns[1] < 3 && Columns[0] != Columns[1])
+			{
+				for (int32 Row = 0; Row < 3; Row++)
+				{
+					Transform.M[Row][0] = Transform.M[Row][1] = Transform.M[Row][2] = 0.f;
+				}
+				for (int32 Row = 0; Row < 3; Row++)
+				{
+					Transform.M[Columns[Row]][Row] = (Bits >> (4 + Row)) & 1 ? -1.f : 1.f;
+				}
+			}
+		}
+		if (const FString* Translation = InFrame.Find(TEXT("_t")))
+		{
+			TArray<FString> Parts;
+			if (Translation->ParseIntoArrayWS(Parts) == 3)
+			{
+				for (int32 Axis = 0; Axis < 3; Axis++)
+				{
+					Transform.M[3][Axis] = FCString::Atoi(*Parts[Axis]);
+				}
+			}
+		}
+		return Transform;
+	}
+}
+
+MagicaVox::FMagicaVoxScene::~FMagicaVoxScene()
+{
+	Reset();
+}
+
+bool MagicaVox::FMagicaVoxScene::Open(const FString& Filename, FString& OutError)
+{
+	Reset();
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	MappedFile.Reset(PlatformFile.OpenMapped(*Filename));
+	if (MappedFile.IsValid() && MappedFile->GetFileSize() > 0)
+	{
+		MappedRegion.Reset(MappedFile->MapRegion(0, MappedFile->GetFileSize()));
+	}
+	if (MappedRegion.IsValid())
+	{
+		Data = MappedRegion->GetMappedPtr();
+		DataSize = MappedRegion->GetMappedSize();
+		return true;
+	}
+	MappedFile.Reset();
+	if (!FFileHelper::LoadFileToArray(Bytes, *Filename))
+	{
+		OutError = TEXT("Error when opening the file");
+		return false;
+	}
+	Data = Bytes.GetData();
+	DataSize = Bytes.Num();
+	return true;
+}
+
+void MagicaVox::FMagicaVoxScene::DecodeModel(int32 ModelIndex)
+{
+	FMagicaVoxModel& Model = Models[ModelIndex];
+	if (Model.bDecoded)
+	{
+		return;
+	}
+	const auto IsValid = [&Model](const uint8* Voxel)
+	{
+		return Voxel[3] != 0 && Voxel[0] < Model.Size.X && Voxel[1] < Model.Size.Y && Voxel[2] < Model.Size.Z;
+	};
+	// first pass also faults the chunk in, unify then reads it from memory
+	int32 NumValid = 0;
+	for (int32 Index = 0; Index < Model.NumVoxels; Index++)
+	{
+		NumValid += IsValid(Model.Voxels + Index * 4);
+	}
+	if (NumValid != Model.NumVoxels)
+	{
+		Model.Filtered.Reserve(NumValid * 4);
+		for (int32 Index = 0; Index < Model.NumVoxels; Index++)
+		{
+			if (IsValid(Model.Voxels + Index * 4))
+			{
+				Model.Filtered.Append(Model.Voxels + Index * 4, 4);
+			}
+		}
+		Model.Voxels = Model.Filtered.GetData();
+		Model.NumVoxels = NumValid;
+	}
+	Model.bDecoded = true;
+}
+
+bool MagicaVox::FMagicaVoxScene::Index(FString& OutError)
+{
+	using namespace MagicaVoxRiff;
+
+	Models.Reset();
+	Instances.Reset();
+	OutError = TEXT("Error when decoding the scene");
+
+	FCursor File{ Data, Data + DataSize };
+	uint32 Magic;
+	int32 Version;
+	uint32 MainId;
+	int32 MainSize;
+	int32 MainChildrenSize;
+	if (!File.Read(Magic) || Magic != Id_VOX || !File.Read(Version) || !File.Read(MainId) || MainId != Id_MAIN || !File.Read(MainSize) || !File.Read(MainChildrenSize) || !File.Skip(MainSize))
+	{
+		return false;
+	}
+	// older exporters write a bogus children size on MAIN, the file end is authoritative
+	FCursor Chunks{ File.Ptr, File.End };
+
+	TMap<int32, FNode> Nodes;
+	FIntVector PendingSize = FIntVector::ZeroValue;
+	while (Chunks.Remaining() > 0)
+	{
+		uint32 ChunkId;
+		int32 ContentSize;
+		int32 ChildrenSize;
+		if (!Chunks.Read(ChunkId) || !Chunks.Read(ContentSize) || !Chunks.Read(ChildrenSize) || ContentSize < 0 || Chunks.Remaining() < ContentSize)
+		{
+			return false;
+		}
+		FCursor Chunk{ Chunks.Ptr, Chunks.Ptr + ContentSize };
+		// children are flattened into the main chunk list, nothing nests below MAIN in practice
+		Chunks.Skip(ContentSize);
+
+		if (ChunkId == Id_SIZE)
+		{
+			if (!Chunk.Read(PendingSize.X) || !Chunk.Read(PendingSize.Y) || !Chunk.Read(PendingSize.Z) || PendingSize.GetMin() <= 0)
+			{
+				return false;
+			}
+			if (PendingSize.GetMax() > MaxModelSize)
+			{
+				OutError = FString::Printf(TEXT("Model size %s is above %d"), *PendingSize.ToString(), MaxModelSize);
+				return false;
+			}
+		}
+		else if (ChunkId == Id_XYZI)
+		{
+			FMagicaVoxModel& Model = Models.AddDefaulted_GetRef();
+			if (PendingSize.GetMin() <= 0 || !Chunk.Read(Model.NumVoxels) || Model.NumVoxels < 0 || Chunk.Remaining() < int64(Model.NumVoxels) * 4)
+			{
+				return false;
+			}
+			Model.Size = PendingSize;
+			Model.Voxels = Chunk.Ptr;
+			PendingSize = FIntVector::ZeroValue;
+		}
+		else if (ChunkId == Id_nTRN)
+		{
+			int32 NodeId;
+			int32 ReservedId;
+			int32 NumFrames;
+			TMap<FString, FString> Attributes;
+			FNode Node;
+			Node.Type = FNode::EType::Transform;
+			Node.Children.SetNumUninitialized(1);
+			if (!Chunk.Read(NodeId) || !Chunk.Read(Attributes) || !Chunk.Read(Node.Children[0]) || !Chunk.Read(ReservedId) || !Chunk.Read(Node.LayerIndex) || !Chunk.Read(NumFrames))
+			{
+				return false;
+			}
+			// only the first frame, animation is not imported
+			TMap<FString, FString> Frame;
+			if (NumFrames > 0 && !Chunk.Read(Frame))
+			{
+				return false;
+			}
+			Node.Transform = MakeTransform(Frame);
+			Nodes.Add(NodeId, MoveTemp(Node));
+		}
+		else if (ChunkId == Id_nGRP || ChunkId == Id_nSHP)
+		{
+			const bool bShape = ChunkId == Id_nSHP;
+			int32 NodeId;
+			int32 NumChildren;
+			TMap<FString, FString> Attributes;
+			FNode Node;
+			Node.Type = bShape ? FNode::EType::Shape : FNode::EType::Group;
+			if (!Chunk.Read(NodeId) || !Chunk.Read(Attributes) || !Chunk.Read(NumChildren) || NumChildren < 0 || Chunk.Remaining() < int64(NumChildren) * 4)
+			{
+				return false;
+			}
+			Node.Children.SetNumUninitialized(NumChildren);
+			for (int32& Child : Node.Children)
+			{
+				TMap<FString, FString> ModelAttributes;
+				if (!Chunk.Read(Child) || (bShape && !Chunk.Read(ModelAttributes)))
+				{
+					return false;
+				}
+			}
+			Nodes.Add(NodeId, MoveTemp(Node));
+		}
+
+		if (!Chunks.Skip(ChildrenSize))
+		{
+			return false;
+		}
+	}
+
+	if (Models.Num() == 0)
+	{
+		OutError = TEXT("No models in the file");
+		return false;
+	}
+	if (Nodes.Num() == 0)
+	{
+		// files without a scene graph place every model once at the origin
+		for (int32 Index = 0; Index < Models.Num(); Index++)
+		{
+			if (Models[Index].NumVoxels > 0)
+			{
+				Instances.Add({ Index, 0, FMatrix44f::Identity });
+			}
+		}
+	}
+	else
+	{
+		AddInstances(Nodes, 0, FMatrix44f::Identity, 0, 0);
+	}
+	OutError.Reset();
+	return true;
+}
+
+void MagicaVox::FMagicaVoxScene::AddInstances(const TMap<int32, FNode>& InNodes, int32 InNodeId, const FMatrix44f& InParentTransform, int32 InLayerIndex, int32 InDepth)
+{
+	const FNode* Node = InNodes.Find(InNodeId);
+	// a valid graph is a tree, deeper than its node count means a cycle
+	if (Node == nullptr || InDepth > InNodes.Num())
+	{
+		return;
+	}
+	switch (Node->Type)
+	{
+	case FNode::EType::Transform:
+		AddInstances(InNodes, Node->Children[0], Node->Transform * InParentTransform, Node->LayerIndex, InDepth + 1);
+		break;
+	case FNode::EType::Group:
+		for (const int32 Child : Node->Children)
+		{
+			AddInstances(InNodes, Child, InParentTransform, InLayerIndex, InDepth + 1);
+		}
+		break;
+	case FNode::EType::Shape:
+		// empty models have nothing to merge and no meaningful bounds
+		for (const int32 ModelIndex : Node->Children)
+		{
+			if (Models.IsValidIndex(ModelIndex) && Models[ModelIndex].NumVoxels > 0)
+			{
+				Instances.Add({ ModelIndex, InLayerIndex, InParentTransform });
+			}
+		}
+		break;
+	}
+}
+
+void MagicaVox::FMagicaVoxScene::Reset()
+{
+	Models.Empty();
+	Instances.Empty();
+	Data = nullptr;
+	DataSize = 0;
+	MappedRegion.Reset();
+	MappedFile.Reset();
+	Bytes.Empty();
+}
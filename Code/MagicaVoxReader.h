@@ -0,0 +1,77 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+namespace MagicaVox
+{
+	// one SIZE + XYZI pair, Voxels points into the file: 4 bytes per voxel, x y z and color index
+	// once decoded every voxel is inside Size and not empty, Voxels only moves to Filtered when the file had voxels to drop
+	struct FMagicaVoxModel
+	{
+		FIntVector Size = FIntVector::ZeroValue;
+		const uint8* Voxels = nullptr;
+		int32 NumVoxels = 0;
+		bool bDecoded = false;
+		TArray<uint8> Filtered;
+	};
+
+	// shape reached through the scene graph, Transform is already combined with every parent node
+	struct FMagicaVoxInstance
+	{
+		int32 ModelIndex = INDEX_NONE;
+		int32 LayerIndex = 0;
+		FMatrix44f Transform = FMatrix44f::Identity;
+	};
+
+	// memory mapped .vox file. chunks are indexed in place, voxel lists are never copied
+	class FMagicaVoxScene
+	{
+	public:
+		FMagicaVoxScene() = default;
+		~FMagicaVoxScene();
+
+		FMagicaVoxScene(const FMagicaVoxScene&) = delete;
+		FMagicaVoxScene& operator=(const FMagicaVoxScene&) = delete;
+
+		// maps the file, falls back to reading it on platforms without mapped files
+		bool Open(const FString& Filename, FString& OutError);
+		// walks the RIFF chunks once: model chunk offsets from SIZE/XYZI, instances from nTRN/nGRP/nSHP
+		bool Index(FString& OutError);
+		// validates one model's voxel list, models are independent and can be decoded in parallel
+		void DecodeModel(int32 ModelIndex);
+		void Reset();
+
+		// models must be decoded before unify reads them
+		const TArray<FMagicaVoxModel>& GetModels() const { return Models; }
+		const TArray<FMagicaVoxInstance>& GetInstances() const { return Instances; }
+		// the whole file as opened
+		const uint8* GetFileData() const { return Data; }
+		int64 GetFileSize() const { return DataSize; }
+
+	private:
+		struct FNode
+		{
+			enum class EType : uint8 { Transform, Group, Shape };
+
+			EType Type = EType::Group;
+			int32 LayerIndex = 0;
+			FMatrix44f Transform = FMatrix44f::Identity;
+			// child node for transforms, child nodes for groups, models for shapes
+			TArray<int32> Children;
+		};
+
+		void AddInstances(const TMap<int32, FNode>& InNodes, int32 InNodeId, const FMatrix44f& InParentTransform, int32 InLayerIndex, int32 InDepth);
+
+		TUniquePtr<IMappedFileHandle> MappedFile;
+		TUniquePtr<IMappedFileRegion> MappedRegion;
+		TArray<uint8> Bytes;
+		const uint8* Data = nullptr;
+		int64 DataSize = 0;
+
+		TArray<FMagicaVoxModel> Models;
+		TArray<FMagicaVoxInstance> Instances;
+	};
+}
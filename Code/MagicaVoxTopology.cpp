@@ -0,0 +1,139 @@
+#include "Importers/MagicaVoxTopology.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/AllowWindowsPlatformTypes.h"
+#include <Windows.h>
+#include "Windows/HideWindowsPlatformTypes.h"
+#elif PLATFORM_LINUX
+#include <stdio.h>
+#endif
+
+namespace MagicaVoxTopology
+{
+	// physical cores and last level caches as logical core masks. siblings aren't always numbered consecutively,
+	// linux and many windows machines number them N and N + the number of physical cores
+	struct FTopology
+	{
+		TArray<uint64> Cores;
+		TArray<uint64> Caches;
+	};
+
+#if PLATFORM_WINDOWS
+	static TArray<uint8> GetProcessorInformation(LOGICAL_PROCESSOR_RELATIONSHIP InRelation)
+	{
+		DWORD Length = 0;
+		GetLogicalProcessorInformationEx(InRelation, nullptr, &Length);
+		TArray<uint8> Buffer;
+		Buffer.SetNumUninitialized(Length);
+		if (Length == 0 || !GetLogicalProcessorInformationEx(InRelation, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(Buffer.GetData()), &Length))
+		{
+			Buffer.Reset();
+		}
+		return Buffer;
+	}
+
+	static FTopology GetTopology()
+	{
+		FTopology Topology;
+		const TArray<uint8> Cores = GetProcessorInformation(RelationProcessorCore);
+		for (int32 Offset = 0; Offset < Cores.Num();)
+		{
+			const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& Info = *reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(Cores.GetData() + Offset);
+			// thread affinities are masks of processor group 0
+			if (Info.Processor.GroupCount == 1 && Info.Processor.GroupMask[0].Group == 0)
+			{
+				Topology.Cores.Add(uint64(Info.Processor.GroupMask[0].Mask));
+			}
+			Offset += Info.Size;
+		}
+		const TArray<uint8> Caches = GetProcessorInformation(RelationCache);
+		for (int32 Offset = 0; Offset < Caches.Num();)
+		{
+			const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& Info = *reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(Caches.GetData() + Offset);
+			if (Info.Cache.Level == 3 && Info.Cache.GroupMask.Group == 0)
+			{
+				Topology.Caches.AddUnique(uint64(Info.Cache.GroupMask.Mask));
+			}
+			Offset += Info.Size;
+		}
+		return Topology;
+	}
+#elif PLATFORM_LINUX
+	// sysfs cpu lists like "0,8" or "0-3", these files don't report their size so they're read with stdio
+	static uint64 ReadCpuList(const char* InPath)
+	{
+		FILE* File = fopen(InPath, "r");
+		if (File == nullptr)
+		{
+			return 0;
+		}
+		char Line[256] = {};
+		const bool bRead = fgets(Line, sizeof(Line), File) != nullptr;
+		fclose(File);
+		if (!bRead)
+		{
+			return 0;
+		}
+		uint64 Mask = 0;
+		TArray<FString> Ranges;
+		FString(ANSI_TO_TCHAR(Line)).TrimStartAndEnd().ParseIntoArray(Ranges, TEXT(","));
+		for (const FString& Range : Ranges)
+		{
+			FString First = Range;
+			FString Last = Range;
+			Range.Split(TEXT("-"), &First, &Last);
+			for (int32 Cpu = FCString::Atoi(*First); Cpu <= FCString::Atoi(*Last) && Cpu < 64; Cpu++)
+			{
+				Mask |= uint64(1) << Cpu;
+			}
+		}
+		return Mask;
+	}
+
+	static FTopology GetTopology()
+	{
+		FTopology Topology;
+		for (int32 Cpu = 0; Cpu < 64; Cpu++)
+		{
+			char Path[128];
+			FCStringAnsi::Snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", Cpu);
+			if (const uint64 Core = ReadCpuList(Path))
+			{
+				Topology.Cores.AddUnique(Core);
+			}
+			// index3 is the L3 wherever there is one
+			FCStringAnsi::Snprintf(Path, sizeof(Path), "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", Cpu);
+			if (const uint64 Cache = ReadCpuList(Path))
+			{
+				Topology.Caches.AddUnique(Cache);
+			}
+		}
+		return Topology;
+	}
+#else
+	static FTopology GetTopology()
+	{
+		return {};
+	}
+#endif
+}
+
+TArray<uint64> MagicaVox::GetPhysicalCoreMasks()
+{
+	MagicaVoxTopology::FTopology Topology = MagicaVoxTopology::GetTopology();
+	const auto GetFirstCore = [](uint64 Mask) { return int32(FMath::CountTrailingZeros64(Mask)); };
+	Topology.Caches.Sort([&](uint64 A, uint64 B) { return GetFirstCore(A) < GetFirstCore(B); });
+	// cores outside any reported cache sort last
+	const auto GetCache = [&](uint64 Core)
+	{
+		const int32 Cache = Topology.Caches.IndexOfByPredicate([&](uint64 Mask) { return (Mask & Core) != 0; });
+		return Cache != INDEX_NONE ? Cache : Topology.Caches.Num();
+	};
+	Topology.Cores.Sort([&](uint64 A, uint64 B)
+	{
+		const int32 CacheA = GetCache(A);
+		const int32 CacheB = GetCache(B);
+		return CacheA != CacheB ? CacheA < CacheB : GetFirstCore(A) < GetFirstCore(B);
+	});
+	return MoveTemp(Topology.Cores);
+}
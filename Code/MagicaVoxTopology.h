@@ -0,0 +1,10 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+namespace MagicaVox
+{
+	// logical core mask of every physical core among the first 64 logical cores, empty when the platform doesn't say.
+	// cores sharing a last level cache come next to each other, in the order of their first logical core
+	TArray<uint64> GetPhysicalCoreMasks();
+}
@@ -0,0 +1,525 @@
+#include "Importers/MagicaVoxTrace.h"
+
+#include "HAL/IConsoleManager.h"
+#include "HAL/ThreadManager.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+static TAutoConsoleVariable<int32> CVarImportTrace(TEXT("voxel.ImportTrace"), 0, TEXT("record import phases and pool works, see voxel.ImportTrace.Save and voxel.ImportTrace.Summary"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarLogImport(TEXT("voxel.LogImport"), 0, TEXT("capture the value pass on layer voxel.DebugSurfaceLevel and save it to Saved/Logs once the import is done. 2 = also log it"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarDebugSurfaceLevel(TEXT("voxel.DebugSurfaceLevel"), 70, TEXT("layer voxel.LogImport captures"), ECVF_Default);
+
+namespace MagicaVoxTrace
+{
+	struct FWorkEvent
+	{
+		FName Name;
+		double QueuedTime;
+		double StartTime;
+		double EndTime;
+	};
+
+	struct FPhaseEvent
+	{
+		FName Name;
+		int32 Import;
+		double StartTime;
+		double EndTime;
+	};
+
+	// one track of the trace. a buffer outlives its thread and is reused by the next one, pool threads come and go
+	// while a trace is recorded. it keeps the name of the first thread, recreated pool threads take the track of the one they replace
+	struct FThreadBuffer
+	{
+		FString Name;
+		FCriticalSection Section;
+		TArray<FWorkEvent> Events;
+	};
+
+	// copied out of a buffer, Id is its index in Buffers
+	struct FTrack
+	{
+		int32 Id;
+		FString Name;
+		TArray<FWorkEvent> Events;
+	};
+
+	// only grows as far as the most threads that recorded at the same time
+	static FCriticalSection BuffersSection;
+	static TArray<TUniquePtr<FThreadBuffer>> Buffers;
+	static TArray<FThreadBuffer*> FreeBuffers;
+
+	// releases the thread's buffer or ring when the thread exits
+	template<typename T>
+	struct TThreadSlot
+	{
+		T* Value = nullptr;
+		FCriticalSection& Section;
+		TArray<T*>& FreeList;
+
+		TThreadSlot(FCriticalSection& InSection, TArray<T*>& InFreeList) : Section(InSection), FreeList(InFreeList) {};
+		~TThreadSlot()
+		{
+			if (Value != nullptr)
+			{
+				FScopeLock Lock(&Section);
+				FreeList.Add(Value);
+			}
+		}
+	};
+	static thread_local TThreadSlot<FThreadBuffer> ThreadBuffer(BuffersSection, FreeBuffers);
+
+	static FCriticalSection PhasesSection;
+	static TArray<FPhaseEvent> Phases;
+
+	static FThreadSafeCounter64 Counters[int32(MagicaVox::EMagicaVoxTraceCounter::Num)];
+	static FThreadSafeCounter NextImportId;
+
+	static const TCHAR* CounterNames[] = { TEXT("cells"), TEXT("classified_voxels"), TEXT("border_voxels"), TEXT("neighbour_probes") };
+	static_assert(UE_ARRAY_COUNT(CounterNames) == int32(MagicaVox::EMagicaVoxTraceCounter::Num), "one name per counter");
+
+	static FString GetThreadName(uint32 ThreadId)
+	{
+		const FString Name = FThreadManager::GetThreadName(ThreadId);
+		return Name.IsEmpty() ? FString::Printf(TEXT("thread %u"), ThreadId) : Name;
+	}
+
+	static FThreadBuffer& GetThreadBuffer()
+	{
+		if (ThreadBuffer.Value == nullptr)
+		{
+			const FString Name = GetThreadName(FPlatformTLS::GetCurrentThreadId());
+			FScopeLock Lock(&BuffersSection);
+			int32 Free = FreeBuffers.IndexOfByPredicate([&](const FThreadBuffer* Buffer) { return Buffer->Name == Name; });
+			if (Free == INDEX_NONE)
+			{
+				Free = FreeBuffers.Num() - 1;
+			}
+			if (Free != INDEX_NONE)
+			{
+				ThreadBuffer.Value = FreeBuffers[Free];
+				FreeBuffers.RemoveAtSwap(Free);
+			}
+			else
+			{
+				TUniquePtr<FThreadBuffer> Buffer = MakeUnique<FThreadBuffer>();
+				Buffer->Name = Name;
+				ThreadBuffer.Value = Buffer.Get();
+				Buffers.Add(MoveTemp(Buffer));
+			}
+		}
+		return *ThreadBuffer.Value;
+	}
+
+	// copied out so formatting doesn't block the threads still recording
+	static void Gather(TArray<FTrack>& OutTracks, TArray<FPhaseEvent>& OutPhases)
+	{
+		{
+			FScopeLock Lock(&BuffersSection);
+			for (int32 Id = 0; Id < Buffers.Num(); Id++)
+			{
+				FScopeLock BufferLock(&Buffers[Id]->Section);
+				if (Buffers[Id]->Events.Num() > 0)
+				{
+					OutTracks.Add({ Id, Buffers[Id]->Name, Buffers[Id]->Events });
+				}
+			}
+		}
+		FScopeLock Lock(&PhasesSection);
+		OutPhases = Phases;
+	}
+
+	// 64k records per thread, a few MB. single writer, the head is only published after the record is written
+	struct FCaptureRing
+	{
+		static constexpr uint64 Size = 1 << 16;
+
+		TArray<MagicaVox::FMagicaVoxDebugRecord> Records;
+		TAtomic<uint64> Head{ 0 };
+	};
+
+	// a ring outlives its thread and is reused by the next one, its records stay until they're overwritten
+	static FCriticalSection RingsSection;
+	static TArray<TUniquePtr<FCaptureRing>> Rings;
+	static TArray<FCaptureRing*> FreeRings;
+	static thread_local TThreadSlot<FCaptureRing> ThreadRing(RingsSection, FreeRings);
+
+	static FCaptureRing& GetThreadRing()
+	{
+		if (ThreadRing.Value == nullptr)
+		{
+			FScopeLock Lock(&RingsSection);
+			if (FreeRings.Num() > 0)
+			{
+				ThreadRing.Value = FreeRings.Pop(false);
+			}
+			else
+			{
+				TUniquePtr<FCaptureRing> Ring = MakeUnique<FCaptureRing>();
+				Ring->Records.SetNumUninitialized(FCaptureRing::Size);
+				ThreadRing.Value = Ring.Get();
+				Rings.Add(MoveTemp(Ring));
+			}
+		}
+		return *ThreadRing.Value;
+	}
+}
+
+bool MagicaVox::FMagicaVoxTrace::IsEnabled()
+{
+	return CVarImportTrace.GetValueOnAnyThread() != 0;
+}
+
+void MagicaVox::FMagicaVoxTrace::AddWork(FName InName, double InQueuedTime, double InStartTime, double InEndTime)
+{
+	MagicaVoxTrace::FThreadBuffer& Buffer = MagicaVoxTrace::GetThreadBuffer();
+	FScopeLock Lock(&Buffer.Section);
+	Buffer.Events.Add({ InName, InQueuedTime, InStartTime, InEndTime });
+}
+
+void MagicaVox::FMagicaVoxTrace::AddPhase(FName InName, int32 InImport, double InStartTime, double InEndTime)
+{
+	FScopeLock Lock(&MagicaVoxTrace::PhasesSection);
+	MagicaVoxTrace::Phases.Add({ InName, InImport, InStartTime, InEndTime });
+}
+
+void MagicaVox::FMagicaVoxTrace::AddCounter(EMagicaVoxTraceCounter InCounter, int64 InValue)
+{
+	MagicaVoxTrace::Counters[int32(InCounter)].Add(InValue);
+}
+
+int32 MagicaVox::FMagicaVoxTrace::NewImportId()
+{
+	return MagicaVoxTrace::NextImportId.Increment();
+}
+
+void MagicaVox::FMagicaVoxTrace::Reset()
+{
+	using namespace MagicaVoxTrace;
+	{
+		FScopeLock Lock(&BuffersSection);
+		for (const TUniquePtr<FThreadBuffer>& Buffer : Buffers)
+		{
+			FScopeLock BufferLock(&Buffer->Section);
+			Buffer->Events.Empty();
+		}
+	}
+	{
+		FScopeLock Lock(&PhasesSection);
+		Phases.Empty();
+	}
+	for (FThreadSafeCounter64& Counter : Counters)
+	{
+		Counter.Reset();
+	}
+}
+
+bool MagicaVox::FMagicaVoxTrace::Save(const FString& Path)
+{
+	using namespace MagicaVoxTrace;
+	TArray<FTrack> Tracks;
+	TArray<FPhaseEvent> PhaseEvents;
+	Gather(Tracks, PhaseEvents);
+
+	double BaseTime = MAX_dbl;
+	for (const FTrack& Track : Tracks)
+	{
+		for (const FWorkEvent& Event : Track.Events)
+		{
+			BaseTime = FMath::Min(BaseTime, Event.QueuedTime > 0.0 ? Event.QueuedTime : Event.StartTime);
+		}
+	}
+	for (const FPhaseEvent& Event : PhaseEvents)
+	{
+		BaseTime = FMath::Min(BaseTime, Event.StartTime);
+	}
+	const auto ToMicroseconds = [BaseTime](double Time) { return (Time - BaseTime) * 1e6; };
+
+	// pid 0 has a track per thread buffer that holds works, pid 1 a track per import
+	TArray<FString> Events;
+	Events.Add(TEXT("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"MagicaVox import pool\"}}"));
+	Events.Add(TEXT("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MagicaVox imports\"}}"));
+	for (const FTrack& Track : Tracks)
+	{
+		Events.Add(FString::Printf(TEXT("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}"), Track.Id, *Track.Name.ReplaceCharWithEscapedChar()));
+		for (const FWorkEvent& Event : Track.Events)
+		{
+			const double Wait = Event.QueuedTime > 0.0 ? (Event.StartTime - Event.QueuedTime) * 1e6 : 0.0;
+			Events.Add(FString::Printf(TEXT("{\"name\":\"%s\",\"cat\":\"work\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"queue_wait_us\":%.3f}}"),
+				*Event.Name.ToString(), Track.Id, ToMicroseconds(Event.StartTime), (Event.EndTime - Event.StartTime) * 1e6, Wait));
+		}
+	}
+	TSet<int32> NamedImports;
+	for (const FPhaseEvent& Event : PhaseEvents)
+	{
+		if (!NamedImports.Contains(Event.Import))
+		{
+			NamedImports.Add(Event.Import);
+			Events.Add(FString::Printf(TEXT("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"import %d\"}}"), Event.Import, Event.Import));
+		}
+		Events.Add(FString::Printf(TEXT("{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}"),
+			*Event.Name.ToString(), Event.Import, ToMicroseconds(Event.StartTime), (Event.EndTime - Event.StartTime) * 1e6));
+	}
+
+	TArray<FString> CounterValues;
+	for (int32 Counter = 0; Counter < UE_ARRAY_COUNT(CounterNames); Counter++)
+	{
+		CounterValues.Add(FString::Printf(TEXT("\"%s\":%lld"), CounterNames[Counter], Counters[Counter].GetValue()));
+	}
+	const FString Json = FString::Printf(TEXT("{\"traceEvents\":[\n%s\n],\n\"otherData\":{%s}}\n"), *FString::Join(Events, TEXT(",\n")), *FString::Join(CounterValues, TEXT(",")));
+	return FFileHelper::SaveStringToFile(Json, *Path);
+}
+
+void MagicaVox::FMagicaVoxTrace::LogSummary()
+{
+	using namespace MagicaVoxTrace;
+	TArray<FTrack> Tracks;
+	TArray<FPhaseEvent> PhaseEvents;
+	Gather(Tracks, PhaseEvents);
+
+	struct FStats
+	{
+		int32 Num = 0;
+		double Total = 0.0;
+		double Max = 0.0;
+		double TotalWait = 0.0;
+		double MaxWait = 0.0;
+
+		void Add(double Duration, double Wait)
+		{
+			Num++;
+			Total += Duration;
+			Max = FMath::Max(Max, Duration);
+			TotalWait += Wait;
+			MaxWait = FMath::Max(MaxWait, Wait);
+		}
+	};
+
+	TMap<FName, FStats> PhaseStats;
+	for (const FPhaseEvent& Event : PhaseEvents)
+	{
+		PhaseStats.FindOrAdd(Event.Name).Add(Event.EndTime - Event.StartTime, 0.0);
+	}
+	TMap<FName, FStats> WorkStats;
+	TArray<FStats> ThreadStats;
+	ThreadStats.SetNum(Tracks.Num());
+	int32 NumWorks = 0;
+	double FirstStart = MAX_dbl;
+	double LastEnd = 0.0;
+	for (int32 Index = 0; Index < Tracks.Num(); Index++)
+	{
+		NumWorks += Tracks[Index].Events.Num();
+		for (const FWorkEvent& Event : Tracks[Index].Events)
+		{
+			const double Duration = Event.EndTime - Event.StartTime;
+			const double Wait = Event.QueuedTime > 0.0 ? Event.StartTime - Event.QueuedTime : 0.0;
+			WorkStats.FindOrAdd(Event.Name).Add(Duration, Wait);
+			ThreadStats[Index].Add(Duration, Wait);
+			FirstStart = FMath::Min(FirstStart, Event.StartTime);
+			LastEnd = FMath::Max(LastEnd, Event.EndTime);
+		}
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("MagicaVox import trace: %d phases, %d works on %d threads"), PhaseEvents.Num(), NumWorks, ThreadStats.Num());
+	for (const auto& Phase : PhaseStats)
+	{
+		UE_LOG(LogTemp, Display, TEXT("  phase %-8s %4d x %9.3f ms total"), *Phase.Key.ToString(), Phase.Value.Num, Phase.Value.Total * 1e3);
+	}
+	for (const auto& Work : WorkStats)
+	{
+		UE_LOG(LogTemp, Display, TEXT("  work %-24s %7d x  mean %8.3f ms  max %8.3f ms  queue wait mean %8.3f ms  max %8.3f ms"),
+			*Work.Key.ToString(), Work.Value.Num, Work.Value.Total / Work.Value.Num * 1e3, Work.Value.Max * 1e3, Work.Value.TotalWait / Work.Value.Num * 1e3, Work.Value.MaxWait * 1e3);
+	}
+	if (ThreadStats.Num() > 0)
+	{
+		// busy time against the span every thread could have worked in
+		const double Span = LastEnd - FirstStart;
+		double TotalBusy = 0.0;
+		double MaxBusy = 0.0;
+		for (int32 Index = 0; Index < Tracks.Num(); Index++)
+		{
+			UE_LOG(LogTemp, Display, TEXT("  thread %-24s %7d works  busy %9.3f ms"), *Tracks[Index].Name, ThreadStats[Index].Num, ThreadStats[Index].Total * 1e3);
+			TotalBusy += ThreadStats[Index].Total;
+			MaxBusy = FMath::Max(MaxBusy, ThreadStats[Index].Total);
+		}
+		const double MeanBusy = TotalBusy / ThreadStats.Num();
+		UE_LOG(LogTemp, Display, TEXT("  span %.3f ms, utilization %.1f%%, busiest thread %.2fx the mean"), Span * 1e3, Span > 0.0 ? TotalBusy / (Span * ThreadStats.Num()) * 100.0 : 0.0, MeanBusy > 0.0 ? MaxBusy / MeanBusy : 0.0);
+	}
+	for (int32 Counter = 0; Counter < UE_ARRAY_COUNT(CounterNames); Counter++)
+	{
+		UE_LOG(LogTemp, Display, TEXT("  %s %lld"), CounterNames[Counter], Counters[Counter].GetValue());
+	}
+}
+
+int32 MagicaVox::FMagicaVoxDebugCapture::GetCaptureLevel()
+{
+	return CVarLogImport.GetValueOnAnyThread() > 0 ? CVarDebugSurfaceLevel.GetValueOnAnyThread() : INDEX_NONE;
+}
+
+void MagicaVox::FMagicaVoxDebugCapture::Add(const FMagicaVoxDebugRecord& InRecord)
+{
+	MagicaVoxTrace::FCaptureRing& Ring = MagicaVoxTrace::GetThreadRing();
+	const uint64 Head = Ring.Head.Load(EMemoryOrder::Relaxed);
+	Ring.Records[Head % MagicaVoxTrace::FCaptureRing::Size] = InRecord;
+	Ring.Head.Store(Head + 1);
+}
+
+TArray<MagicaVox::FMagicaVoxDebugRecord> MagicaVox::FMagicaVoxDebugCapture::Gather(int32 InImport)
+{
+	using namespace MagicaVoxTrace;
+	TArray<FMagicaVoxDebugRecord> Result;
+	TArray<FMagicaVoxDebugRecord> Copy;
+	bool bOverwritten = false;
+	{
+		FScopeLock Lock(&RingsSection);
+		for (const TUniquePtr<FCaptureRing>& Ring : Rings)
+		{
+			// other imports may still be recording. copy first, then drop whatever their writers reached while we copied:
+			// record i shares its slot with i + Size, and the record at the head may be half written
+			const uint64 Head = Ring->Head.Load();
+			const uint64 First = Head > FCaptureRing::Size ? Head - FCaptureRing::Size : 0;
+			Copy.SetNumUninitialized(int32(Head - First), false);
+			for (uint64 Index = First; Index < Head; Index++)
+			{
+				Copy[int32(Index - First)] = Ring->Records[Index % FCaptureRing::Size];
+			}
+			FPlatformMisc::MemoryBarrier();
+			const uint64 WrittenHead = Ring->Head.Load();
+			const uint64 FirstIntact = WrittenHead >= FCaptureRing::Size ? WrittenHead - FCaptureRing::Size + 1 : 0;
+			const uint64 FirstKept = FMath::Max(First, FirstIntact);
+			bOverwritten |= FirstKept > 0;
+			for (uint64 Index = FirstKept; Index < Head; Index++)
+			{
+				const FMagicaVoxDebugRecord& Record = Copy[int32(Index - First)];
+				if (InImport == INDEX_NONE || Record.Import == InImport)
+				{
+					Result.Add(Record);
+				}
+			}
+		}
+	}
+	if (bOverwritten)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("voxel.LogImport rings wrapped, the oldest records are lost"));
+	}
+	Result.Sort([](const FMagicaVoxDebugRecord& A, const FMagicaVoxDebugRecord& B)
+	{
+		if (A.Import != B.Import) return A.Import < B.Import;
+		if (A.Z != B.Z) return A.Z < B.Z;
+		if (A.Y != B.Y) return A.Y < B.Y;
+		return A.X < B.X;
+	});
+	return Result;
+}
+
+bool MagicaVox::FMagicaVoxDebugCapture::Save(const FString& Path, TArrayView<const FMagicaVoxDebugRecord> InRecords)
+{
+	TArray<FString> Lines;
+	Lines.Reserve(InRecords.Num() + 1);
+	Lines.Add(TEXT("import,kind,x,y,z,color,clock_pos,center_x,center_y,inside,outside,shift,flags"));
+	for (const FMagicaVoxDebugRecord& Record : InRecords)
+	{
+		Lines.Add(FString::Printf(TEXT("%d,%s,%d,%d,%d,%d,%d,%.1f,%.1f,%.3f,%.3f,%d,%d"), Record.Import, Record.Kind == FMagicaVoxDebugRecord::EKind::Voxel ? TEXT("voxel") : TEXT("empty"),
+			Record.X, Record.Y, Record.Z, Record.Color, Record.ClockPos, Record.CenterX, Record.CenterY, Record.Inside, Record.Outside, Record.Shift, Record.Flags));
+	}
+	return FFileHelper::SaveStringArrayToFile(Lines, *Path);
+}
+
+void MagicaVox::FMagicaVoxDebugCapture::Log(TArrayView<const FMagicaVoxDebugRecord> InRecords)
+{
+	for (const FMagicaVoxDebugRecord& Record : InRecords)
+	{
+		if (Record.Kind == FMagicaVoxDebugRecord::EKind::Empty)
+		{
+			UE_LOG(LogTemp, Display, TEXT("DoWorkEmpty %d %d %d %d. Left[%d] Right[%d]"), Record.X, Record.Y, Record.Z, Record.Color, (Record.Flags & 1) != 0, (Record.Flags & 2) != 0);
+			continue;
+		}
+		const FString Center = FVector(Record.CenterX, Record.CenterY, Record.Z).ToString();
+		const float Dist = FMath::Abs(Record.Y - Record.CenterY);
+		if (Record.Shift != 0)
+		{
+			UE_LOG(LogTemp, Display, TEXT("DoWorkDual %d %d %d %d %.3f. CP[%d] Center[%s] Dist[%.1f]"), Record.X + Record.Shift, Record.Y, Record.Z, Record.Color, Record.Outside, Record.ClockPos, *Center, Dist);
+		}
+		UE_LOG(LogTemp, Display, TEXT("DoWorkFull %d %d %d %d %.3f. CP[%d] Center[%s] Dist[%.1f]"), Record.X, Record.Y, Record.Z, Record.Color, Record.Inside, Record.ClockPos, *Center, Dist);
+	}
+}
+
+void MagicaVox::FMagicaVoxDebugCapture::Dump(int32 InImport, const FString& InSource)
+{
+	if (GetCaptureLevel() == INDEX_NONE)
+	{
+		return;
+	}
+	const TArray<FMagicaVoxDebugRecord> Records = Gather(InImport);
+	if (Records.Num() == 0)
+	{
+		return;
+	}
+	const FString Path = FPaths::ProjectLogDir() / FString::Printf(TEXT("MagicaVoxCapture-%d-%s.csv"), InImport, *FDateTime::Now().ToString());
+	if (Save(Path, Records))
+	{
+		UE_LOG(LogTemp, Display, TEXT("%d value pass records of %s saved to %s"), Records.Num(), *InSource, *Path);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("failed to save import capture to %s"), *Path);
+	}
+	if (CVarLogImport.GetValueOnAnyThread() > 1)
+	{
+		Log(Records);
+	}
+}
+
+void MagicaVox::FMagicaVoxDebugCapture::Reset()
+{
+	using namespace MagicaVoxTrace;
+	FScopeLock Lock(&RingsSection);
+	for (const TUniquePtr<FCaptureRing>& Ring : Rings)
+	{
+		Ring->Head.Store(0);
+	}
+}
+
+static FAutoConsoleCommand ImportTraceSaveCommand(
+	TEXT("voxel.ImportTrace.Save"),
+	TEXT("write the recorded import trace as chrome trace json, to the given path or to Saved/Profiling"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const FString Path = Args.Num() > 0 ? Args[0] : FPaths::ProfilingDir() / FString::Printf(TEXT("MagicaVoxImport-%s.json"), *FDateTime::Now().ToString());
+		if (MagicaVox::FMagicaVoxTrace::Save(Path))
+		{
+			UE_LOG(LogTemp, Display, TEXT("import trace saved to %s"), *Path);
+		}
+		else
+		{
+			UE_LOG(LogTemp, Warning, TEXT("failed to save import trace to %s"), *Path);
+		}
+	}));
+
+static FAutoConsoleCommand ImportTraceSummaryCommand(
+	TEXT("voxel.ImportTrace.Summary"),
+	TEXT("log phase and work times, queue waits, per thread load and counters of the recorded import trace"),
+	FConsoleCommandDelegate::CreateStatic(&MagicaVox::FMagicaVoxTrace::LogSummary));
+
+static FAutoConsoleCommand ImportTraceResetCommand(
+	TEXT("voxel.ImportTrace.Reset"),
+	TEXT("drop the recorded import trace"),
+	FConsoleCommandDelegate::CreateStatic(&MagicaVox::FMagicaVoxTrace::Reset));
+
+static FAutoConsoleCommand LogImportDumpCommand(
+	TEXT("voxel.LogImport.Dump"),
+	TEXT("write every record voxel.LogImport still holds as csv, to the given path or to Saved/Logs"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const FString Path = Args.Num() > 0 ? Args[0] : FPaths::ProjectLogDir() / FString::Printf(TEXT("MagicaVoxCapture-%s.csv"), *FDateTime::Now().ToString());
+		const TArray<MagicaVox::FMagicaVoxDebugRecord> Records = MagicaVox::FMagicaVoxDebugCapture::Gather(INDEX_NONE);
+		if (MagicaVox::FMagicaVoxDebugCapture::Save(Path, Records))
+		{
+			UE_LOG(LogTemp, Display, TEXT("%d import capture records saved to %s"), Records.Num(), *Path);
+		}
+		else
+		{
+			UE_LOG(LogTemp, Warning, TEXT("failed to save import capture to %s"), *Path);
+		}
+	}));
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// 0 compiles the voxel.LogImport capture out of the value pass
+#ifndef MAGICAVOX_DEBUG_CAPTURE
+#define MAGICAVOX_DEBUG_CAPTURE !UE_BUILD_SHIPPING
+#endif
+
+namespace MagicaVox
+{
+	enum class EMagicaVoxTraceCounter : uint8
+	{
+		// asset cells the value pass wrote
+		Cells,
+		// solid voxels and their halo neighbours the value pass classified
+		ClassifiedVoxels,
+		// classified voxels on a hexagon border
+		BorderVoxels,
+		// occupancy lookups while resolving borders
+		NeighbourProbes,
+		Num,
+	};
+
+	// import timeline recorded while voxel.ImportTrace is on: every pool work with its queue and run times, and every import phase.
+	// works are recorded into a buffer per thread, which is only contended while the trace is saved or summarized. buffers of exited threads are reused
+	// see voxel.ImportTrace.Save, voxel.ImportTrace.Summary and voxel.ImportTrace.Reset
+	class FMagicaVoxTrace
+	{
+	public:
+		static bool IsEnabled();
+
+		// FPlatformTime::Seconds, InQueuedTime is 0 for works queued while tracing was off
+		static void AddWork(FName InName, double InQueuedTime, double InStartTime, double InEndTime);
+		// InImport tells concurrent imports apart
+		static void AddPhase(FName InName, int32 InImport, double InStartTime, double InEndTime);
+		static void AddCounter(EMagicaVoxTraceCounter InCounter, int64 InValue);
+		static int32 NewImportId();
+
+		static void Reset();
+		// chrome trace event format, opens in chrome://tracing or ui.perfetto.dev
+		static bool Save(const FString& Path);
+		// per phase and per work times, queue waits, busy time per thread and the counters
+		static void LogSummary();
+	};
+
+	// one value pass decision on the captured layer
+	struct FMagicaVoxDebugRecord
+	{
+		enum class EKind : uint8
+		{
+			// a solid voxel's classification, Outside goes to X + Shift when Shift isn't 0
+			Voxel,
+			// an empty cell, Flags bit 0 when the left neighbour wrote it, bit 1 the right one
+			Empty,
+		};
+
+		int32 Import;
+		int32 X;
+		int32 Y;
+		int32 Z;
+		float CenterX;
+		float CenterY;
+		float Inside;
+		float Outside;
+		uint8 Color;
+		int8 ClockPos;
+		int8 Shift;
+		EKind Kind;
+		uint8 Flags;
+	};
+
+	// voxel.LogImport capture: value pass works record the decisions of one layer into a ring per thread, the import dumps them once it's done.
+	// recording never locks or formats, a thread takes a ring once and older records are overwritten when it is full. rings of exited threads are reused
+	class FMagicaVoxDebugCapture
+	{
+	public:
+		// voxel.DebugSurfaceLevel while voxel.LogImport is on, INDEX_NONE otherwise. read once per value pass, not per layer
+		static int32 GetCaptureLevel();
+		static void Add(const FMagicaVoxDebugRecord& InRecord);
+
+		// sorted by Z, Y then X. only once every work of InImport is done, INDEX_NONE for every import. rings are copied without waiting
+		// for their writers, records other imports overwrite meanwhile are dropped
+		static TArray<FMagicaVoxDebugRecord> Gather(int32 InImport);
+		// csv, one line per record, enough to rebuild the captured layer
+		static bool Save(const FString& Path, TArrayView<const FMagicaVoxDebugRecord> InRecords);
+		// the lines voxel.LogImport used to log from inside the value pass
+		static void Log(TArrayView<const FMagicaVoxDebugRecord> InRecords);
+		// saves what InImport captured to Saved/Logs when voxel.LogImport is on, and logs it at 2. once every work of InImport is done
+		static void Dump(int32 InImport, const FString& InSource);
+		// not while an import records
+		static void Reset();
+	};
+}